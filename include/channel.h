@@ -0,0 +1,79 @@
+// Logical channel multiplexer header.
+
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include "pool.h"
+
+// Number of logical channels of a link. Channel 0 is the bulk channel: the data packets
+// of the file transfer, which are sent directly and always come last.
+#define MAX_CHANNELS 8
+#define CHANNEL_BULK 0
+
+// Packet type of a channel message: type, sequence, channel, length (2 bytes) and data.
+#define PACKET_CHANNEL 11
+#define CHANNEL_HEADER_SIZE 5
+
+// Largest message accepted by channelSend.
+#define MAX_CHANNEL_MESSAGE 255
+
+// Number of messages that may be queued at once, over every channel.
+#define CHANNEL_QUEUE_SIZE 16
+
+// Function called with each message received on a channel.
+typedef void (*ChannelHandler)(unsigned char channel, const unsigned char *data, int length, void *context);
+
+// Struct to store a queued message.
+typedef struct ChannelMessage {
+    struct ChannelMessage *next; // Next message of the same channel
+    int length;                  // Length of the data
+    unsigned char data[MAX_CHANNEL_MESSAGE];
+} ChannelMessage;
+
+// Struct to store the state of one channel.
+typedef struct {
+    int open;                    // Flag to indicate the channel was opened
+    unsigned char priority;      // Channels of higher priority are always served first
+    int quantum;                 // Bytes credited per round among channels of equal priority
+    int deficit;                 // Bytes the channel may still send in this round
+    ChannelMessage *head;        // First queued message
+    ChannelMessage *tail;        // Last queued message
+    ChannelHandler handler;      // Receives the messages of the channel
+    void *context;               // User context of the handler
+} Channel;
+
+// Struct to store the channels of a link.
+typedef struct {
+    Channel channels[MAX_CHANNELS];
+    Pool messages;               // Queued messages, allocated once by channelMuxInit
+    int next;                    // Channel the next round robin search starts from
+    unsigned char sequence;      // Sequence number of the next channel packet
+} ChannelMux;
+
+// Function to initialise a multiplexer with every channel closed.
+// Returns "1" on success or "-1" on error.
+int channelMuxInit(ChannelMux *mux);
+
+// Function to open a channel. Messages are sent by strict priority, and channels of equal
+// priority share the link in proportion to their quantum (deficit round robin).
+// Returns "1" on success or "-1" on error.
+int channelOpen(ChannelMux *mux, unsigned char channel, unsigned char priority, int quantum,
+                ChannelHandler handler, void *context);
+
+// Function to queue a message on a channel, to be sent by channelFlush.
+// Returns "1" on success or "-1" on error (including CHANNEL_QUEUE_SIZE messages already queued).
+int channelSend(ChannelMux *mux, unsigned char channel, const unsigned char *data, int length);
+
+// Function to send every queued message with a priority of at least "priority", in
+// scheduling order. Called between bulk data packets, so urgent messages cut ahead of them.
+// Returns the number of messages sent or "-1" on error.
+int channelFlush(ChannelMux *mux, unsigned char priority);
+
+// Function to hand a received channel packet to the handler of its channel.
+// Returns "1" if it was delivered or "-1" if it is malformed or its channel is closed.
+int channelDispatch(ChannelMux *mux, const unsigned char *packet, int size);
+
+// Function to discard the queued messages of every channel and release the queue.
+void channelMuxDestroy(ChannelMux *mux);
+
+#endif // _CHANNEL_H_
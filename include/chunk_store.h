@@ -0,0 +1,76 @@
+// Content-addressed chunk store header.
+
+#ifndef _CHUNK_STORE_H_
+#define _CHUNK_STORE_H_
+
+#include <stddef.h>
+
+// Default location of the receiver's store (".data" and ".index" files are added).
+#define CHUNK_STORE_PATH ".chunkstore"
+
+// Content-defined chunking bounds: a boundary is cut where the gear hash has
+// CHUNK_AVERAGE_BITS low zero bits, giving chunks of about 2^CHUNK_AVERAGE_BITS bytes.
+#define CHUNK_MIN_SIZE 2048
+#define CHUNK_MAX_SIZE 65536
+#define CHUNK_AVERAGE_BITS 13
+
+// Initial number of slots of the index (a power of two).
+#define CHUNK_INDEX_INITIAL_CAPACITY 1024
+
+// Struct to store the header of the index file.
+typedef struct {
+    unsigned int magic;          // Identifies the file as a chunk index
+    unsigned int capacity;       // Number of slots (a power of two)
+    unsigned int count;          // Number of slots in use
+    unsigned int reserved;       // Keeps the slots 8-byte aligned
+} ChunkIndexHeader;
+
+// Struct to store one slot of the index: 16 bytes per chunk.
+typedef struct {
+    unsigned long long hash;     // Chunk hash (0 = empty slot)
+    unsigned long long location; // Offset in the data file << 24 | length
+} ChunkEntry;
+
+// Struct to store an open chunk store: an append-only data file and a memory-mapped
+// open-addressing index of the chunks in it.
+typedef struct {
+    int dataFd;                  // Data file descriptor
+    int indexFd;                 // Index file descriptor
+    ChunkIndexHeader *header;    // Mapped index header
+    ChunkEntry *entries;         // Mapped index slots
+    unsigned long long dataSize; // Size of the data file
+    char indexPath[256];         // Path of the index file
+} ChunkStore;
+
+// Function to find the end of the content-defined chunk starting at "data".
+// Returns the chunk length (at most "length").
+size_t chunkBoundary(const unsigned char *data, size_t length);
+
+// Function to open (or create) the store at "path".
+// Returns "1" on success or "-1" on error.
+int chunkStoreOpen(ChunkStore *store, const char *path);
+
+// Function to look up a chunk by hash.
+// Returns "1" if found (setting "offset" and "length") or "0" otherwise.
+int chunkStoreFind(const ChunkStore *store, unsigned long long hash, unsigned long long *offset,
+                   unsigned int *length);
+
+// Function to append bytes of a new chunk to the data file.
+// Returns "1" on success or "-1" on error.
+int chunkStoreAppend(ChunkStore *store, const unsigned char *data, size_t length);
+
+// Function to index the last "length" appended bytes as the chunk "hash".
+// Returns "1" on success or "-1" on error.
+int chunkStoreCommit(ChunkStore *store, unsigned long long hash, unsigned int length);
+
+// Function to drop the bytes appended since the last commit (e.g. on a hash mismatch).
+void chunkStoreRollback(ChunkStore *store, unsigned int length);
+
+// Function to read "length" bytes of the data file from "offset".
+// Returns "1" on success or "-1" on error.
+int chunkStoreRead(const ChunkStore *store, unsigned long long offset, unsigned char *buf, size_t length);
+
+// Function to close the store.
+void chunkStoreClose(ChunkStore *store);
+
+#endif // _CHUNK_STORE_H_
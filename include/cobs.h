@@ -0,0 +1,52 @@
+// Consistent overhead byte stuffing (COBS) header.
+
+#ifndef _COBS_H_
+#define _COBS_H_
+
+#include <stddef.h>
+
+// COBS removes every zero byte from the data at the cost of one code byte per block
+// of up to 254 bytes, so a frame grows by less than 0.4% whatever its content.
+// Every output byte is XORed with "mask" (FLAG), which turns the removed zero into
+// the removed flag.
+
+// Worst-case size of "length" bytes once encoded.
+#define COBS_MAX_ENCODED_LENGTH(length) ((length) + (length) / 254 + 1)
+
+// Struct to store the state of an encoder fed one buffer at a time.
+typedef struct {
+    unsigned char *output;   // Next free byte of the output
+    unsigned char *code;     // Code byte of the block being encoded
+    unsigned char distance;  // Code of the block being encoded (its length plus one)
+    unsigned char mask;      // Value XORed into every output byte
+} CobsEncoder;
+
+// Struct to store the state of a decoder fed one byte at a time.
+typedef struct {
+    unsigned char left;      // Bytes left in the block being decoded
+    int zero;                // Flag to indicate the block being decoded ends with a zero
+    unsigned char mask;      // Value XORed into every input byte
+} CobsDecoder;
+
+// Function to start encoding into "output".
+void cobsEncoderInit(CobsEncoder *encoder, unsigned char *output, unsigned char mask);
+
+// Function to encode "length" more bytes.
+void cobsEncode(CobsEncoder *encoder, const unsigned char *data, size_t length);
+
+// Function to close the last block.
+// Returns the end of the encoded data.
+unsigned char *cobsEncoderFinish(CobsEncoder *encoder);
+
+// Function to start decoding a new frame.
+void cobsDecoderInit(CobsDecoder *decoder, unsigned char mask);
+
+// Function to decode one input byte.
+// Returns the decoded byte, or "-1" if the input byte was a code byte with nothing to emit.
+int cobsDecode(CobsDecoder *decoder, unsigned char byte);
+
+// Function to check that the input ended on a block boundary.
+// Returns TRUE if the frame was well formed.
+int cobsDecoderComplete(const CobsDecoder *decoder);
+
+#endif // _COBS_H_
@@ -0,0 +1,69 @@
+// Delta transfer header: rolling checksums and block signature matching (rsync-style).
+
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <stddef.h>
+
+// Bounds of the block size chosen by the receiver.
+#define DELTA_MIN_BLOCK_SIZE 256
+#define DELTA_MAX_BLOCK_SIZE 16384
+
+// Initial value of an incremental strong checksum.
+#define STRONG_CHECKSUM_INIT 0xCBF29CE484222325ULL
+
+// Bytes taken by one block signature on the wire: weak (4) and strong (8) checksums.
+#define DELTA_SIGNATURE_SIZE 12
+
+// Struct to store the rolling (weak) checksum of a window of "blockSize" bytes.
+typedef struct {
+    unsigned int a;          // Sum of the bytes in the window
+    unsigned int b;          // Sum of the bytes weighted by their distance to the window end
+    int blockSize;           // Size of the window
+} RollingChecksum;
+
+// Struct to store the block signatures of the receiver's file, indexed by weak checksum.
+typedef struct {
+    int blockSize;           // Size of every block
+    int count;               // Number of blocks
+    unsigned int *weak;      // Weak checksum of each block
+    unsigned long long *strong; // Strong checksum of each block
+    int *heads;              // First block of each hash bucket (-1 if empty)
+    int *next;               // Next block in the same bucket (-1 if last)
+    unsigned int mask;       // Number of buckets minus one
+} SignatureIndex;
+
+// Function to choose the block size for a basis file of "fileSize" bytes.
+int deltaBlockSize(long int fileSize);
+
+// Function to compute the checksum of the window starting at "data".
+// Returns the weak checksum.
+unsigned int rollingInit(RollingChecksum *checksum, const unsigned char *data, int blockSize);
+
+// Function to slide the window by one byte, dropping "out" and taking "in".
+// Returns the weak checksum.
+unsigned int rollingRoll(RollingChecksum *checksum, unsigned char out, unsigned char in);
+
+// Function to compute the strong checksum of a block.
+unsigned long long strongChecksum(const unsigned char *data, size_t length);
+
+// Function to extend a strong checksum with "length" more bytes, for data arriving in pieces.
+// Start from STRONG_CHECKSUM_INIT.
+unsigned long long strongChecksumUpdate(unsigned long long hash, const unsigned char *data, size_t length);
+
+// Function to create an empty index for "count" blocks of "blockSize" bytes.
+// Returns "1" on success or "-1" on error.
+int signatureIndexInit(SignatureIndex *index, int blockSize, int count);
+
+// Function to add the signature of the next block to the index.
+void signatureIndexAdd(SignatureIndex *index, unsigned int weak, unsigned long long strong);
+
+// Function to find a block matching the window at "data", whose weak checksum is "weak".
+// "preferred" is tried first, so consecutive matches extend the same run.
+// Returns the block number or -1 if there is no match.
+int signatureIndexFind(const SignatureIndex *index, unsigned int weak, const unsigned char *data, int preferred);
+
+// Function to release the memory of the index.
+void signatureIndexDestroy(SignatureIndex *index);
+
+#endif // _DELTA_H_
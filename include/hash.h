@@ -0,0 +1,26 @@
+// Incremental file hash header (xxHash64).
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+
+// Struct to store the state of an incremental xxHash64 computation.
+typedef struct {
+    unsigned long long totalLength;  // Bytes hashed so far
+    unsigned long long v[4];         // Lane accumulators
+    unsigned char buffer[32];        // Bytes not yet forming a whole stripe
+    unsigned int buffered;           // Number of bytes in buffer
+    unsigned long long seed;         // Seed of the hash
+} FileHash;
+
+// Function to start a hash with the given seed.
+void fileHashInit(FileHash *hash, unsigned long long seed);
+
+// Function to add "length" bytes to the hash.
+void fileHashUpdate(FileHash *hash, const void *data, size_t length);
+
+// Function to get the hash of every byte added so far (the state is left untouched).
+unsigned long long fileHashDigest(const FileHash *hash);
+
+#endif // _HASH_H_
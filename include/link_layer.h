@@ -1,5 +1,6 @@
 // Header file for the Link Layer protocol implementation.
-// IMPORTANT: Do not modify this file.
+// IMPORTANT: Keep the signatures of llopen, llwrite, llread and llclose, which the
+// application layer is written against. Extensions are declared alongside them.
 
 #ifndef _LINK_LAYER_H_
 #define _LINK_LAYER_H_
@@ -19,6 +20,23 @@ typedef struct {
     int timeout;             // Timeout for communication
 } LinkLayer;
 
+// Enumeration to define how I-frame data is kept free of FLAG bytes, negotiated by llopen.
+typedef enum {
+    FRAMING_STUFFING,        // ESC byte stuffing: up to twice the size for data dense in FLAG / ESC
+    FRAMING_COBS,            // Consistent overhead byte stuffing: one extra byte per 254
+} LinkFraming;
+
+// Struct to store Link Layer transfer statistics, counted since llopen.
+typedef struct {
+    int framesSent;          // I-frames submitted (retransmissions excluded)
+    int framesAcked;         // I-frames acknowledged by the peer
+    int rejections;          // REJ frames received for the pending I-frame
+    int timeouts;            // Timeouts of the pending I-frame
+    int framesRecovered;     // Corrupted I-frames rebuilt by combining received copies
+    int reconnections;       // Times the link went down and was re-established
+    int busy;                // Polls of a busy peer (it held a frame back for a whole timeout)
+} LinkStatistics;
+
 // Enumeration to define Link Layer states.
 typedef enum {
     START,
@@ -30,11 +48,56 @@ typedef enum {
     DATA_FOUND,
     BYTE_DESTUFFING,
     DISCONNECTED,
-    BCC2_CHECK
+    BCC2_CHECK,
+    COBS_DECODING
 } llState;
 
 // Maximum payload size accepted by the Link Layer.
-#define MAX_PAYLOAD_SIZE 100
+#define MAX_PAYLOAD_SIZE 1024
+
+// Bounds and starting point of the adaptive data payload size.
+#define MIN_PAYLOAD_SIZE 16
+#define INITIAL_PAYLOAD_SIZE 128
+
+// Maximum packet accepted by llwrite: a data packet (4-byte header and payload) or a
+// control packet carrying a file name of up to 255 bytes.
+#define MAX_PACKET_SIZE (MAX_PAYLOAD_SIZE + 260)
+
+// Worst-case size of an I-frame carrying MAX_PACKET_SIZE bytes (reached with byte stuffing).
+#define MAX_FRAME_SIZE (6 + 2 * (MAX_PACKET_SIZE + 1))
+
+// Number of buffers in the frame and packet pools.
+#define FRAME_POOL_SIZE 2
+#define PACKET_POOL_SIZE 4
+
+// Number of corrupted copies of an I-frame kept for soft combining, and the largest number of
+// bytes in which two copies may differ for every mix of them to be checked against BCC2.
+#define SOFT_COMBINE_COPIES 2
+#define SOFT_COMBINE_MAX_DIFFERENCES 4
+
+// Keepalive: an idle transmitter probes the receiver every KEEPALIVE_INTERVAL seconds and
+// declares the link down after KEEPALIVE_PROBES probes go unanswered.
+#define KEEPALIVE_INTERVAL 1
+#define KEEPALIVE_PROBES 3
+
+// Re-establishment of a link that went down: SET is sent after 1, 2, 4... seconds (at most
+// RECONNECT_MAX_DELAY apart) until the receiver answers or RECONNECT_TIMEOUT seconds pass.
+#define RECONNECT_MAX_DELAY 8
+#define RECONNECT_TIMEOUT 120
+
+// Bits on the line per byte (8N1: start bit, 8 data bits and stop bit), used to pace writes
+// to the baud rate of the serial port.
+#define BITS_PER_BYTE 10
+
+// Milliseconds the acknowledgment of a delivered frame waits for the next read to be posted
+// (then sent as RR) before RNR holds the transmitter.
+#define ACK_GRACE_PERIOD 100
+
+// Default maximum delay (milliseconds) of a batch of llsend messages.
+#define BATCH_DEFAULT_DELAY 10
+
+// Maximum number of segments accepted by llreadv.
+#define MAX_IOV 8
 
 // Boolean values
 #define FALSE 0
@@ -49,7 +112,15 @@ typedef enum {
 #include <termios.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/time.h>
 #include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "pool.h"
+#include "cobs.h"
+#include "transport.h"
 
 // Define constants for serial communication.
 #define BAUDRATE 38400
@@ -61,18 +132,31 @@ typedef enum {
 #define C_SET 0x03
 #define C_DISC 0x0B
 #define C_UA 0x07
+#define C_SET_COBS 0x13
+#define C_UA_COBS 0x17
+#define C_KEEPALIVE 0x0F
 #define C_RR(tramaRx) ((tramaRx == 0) ? 0x05 : 0x85)
 #define C_REJ(tramaRx) ((tramaRx == 0) ? 0x01 : 0x81)
-#define C_N(Ns) ((Ns == 0) ? 0x00 : 0x40)
+#define C_RNR(tramaRx) ((tramaRx == 0) ? 0x09 : 0x89)
+#define C_I(Ns, Nr) (((Ns) << 6) | ((Nr) << 7))
+#define IS_C_I(ctrlField) (((ctrlField) & 0x3F) == 0)
 
 
 
 
 // Function to establish a connection using the specified parameters.
+// serialPort may also name a UNIX-domain socket ("unix:<path>") or shared memory ("shm:<name>"),
+// see transport.h. Only serial ports are paced to the baud rate.
 // Returns "1" on success or "-1" on error.
 int llopen(LinkLayer connectionParameters);
 
+// Function to choose the framing the transmitter proposes in its SET frame (C_SET_COBS for COBS).
+// The receiver accepts either framing and confirms it in its UA. Must be called before llopen.
+void llsetFraming(LinkFraming framing);
+
 // Function to send data in the provided buffer with the specified size.
+// A frame that runs out of retransmissions does not fail the write: the link is re-established
+// (see RECONNECT_TIMEOUT) and the frame sent again, keeping the sequence numbers.
 // Returns the number of characters written or "-1" on error.
 int llwrite(const unsigned char *buf, int bufSize);
 
@@ -80,9 +164,88 @@ int llwrite(const unsigned char *buf, int bufSize);
 // Returns the number of characters read or "-1" on error.
 int llread(unsigned char *packet);
 
+// Function to send, as a single frame, the data gathered from "iovcnt" segments.
+// Returns the number of characters written or "-1" on error.
+int llwritev(const struct iovec *iov, int iovcnt);
+
+// Function to receive a frame, scattering its data over up to MAX_IOV segments in order.
+// Frames larger than the total segment length are rejected.
+// Returns the number of characters read or "-1" on error.
+int llreadv(const struct iovec *iov, int iovcnt);
+
+// Function to take a packet buffer of MAX_PACKET_SIZE bytes from the link layer pool.
+// Only valid between llopen and llclose.
+// Returns the buffer or NULL if every buffer is in use.
+unsigned char *llgetPacket();
+
+// Function to give a packet buffer back to the link layer pool.
+void llputPacket(unsigned char *packet);
+
+// Function to get the transfer statistics of the current connection.
+void llgetStatistics(LinkStatistics *statistics);
+
+// Completion callback of the asynchronous interface.
+// "result" is the value the blocking call would have returned.
+typedef void (*llCallback)(int result, void *context);
+
+// Function to submit a write without waiting for its acknowledgment.
+// The frame is retransmitted by llprocess until it is acknowledged or the retries run out.
+// Returns "1" if the write was submitted or "-1" on error (e.g. a write is already pending).
+int llwriteAsync(const unsigned char *buf, int bufSize, llCallback callback, void *context);
+int llwritevAsync(const struct iovec *iov, int iovcnt, llCallback callback, void *context);
+
+// Function to post a buffer for the next I-frame, completed by llprocess.
+// Returns "1" if the read was posted or "-1" on error (e.g. a read is already posted).
+int llreadAsync(unsigned char *packet, llCallback callback, void *context);
+int llreadvAsync(const struct iovec *iov, int iovcnt, llCallback callback, void *context);
+
+// Function to get the file descriptor the host event loop should poll for input.
+// Returns "-1" for shared memory, which has none: use llpoll instead.
+int llgetfd();
+
+// Function to wait up to "timeout" milliseconds (-1 forever) for input, whatever the transport.
+// Returns "1" if input is available, "0" on timeout or "-1" on error.
+int llpoll(int timeout);
+
+// Function to get the milliseconds until llprocess must run again, or "-1" if there is no deadline.
+int llnextDeadline();
+
+// Function to drive the asynchronous engine: consume available input, handle expired
+// timeouts and invoke completion callbacks.
+// Returns "1" on success or "-1" on error.
+int llprocess();
+
+// Function to choose how long (milliseconds) and how large (at most MAX_PACKET_SIZE bytes)
+// a batch of llsend messages may grow before it is sent.
+void llsetBatching(int maxDelay, int maxSize);
+
+// Function to send a small message, batched with others into a single frame. A batch goes
+// once the previous one is acknowledged and it is full or its delay expired (checked by
+// llsend and llprocess). Both ends must use llsend / llrecv instead of llwrite / llread.
+// Returns the length of the message or "-1" on error.
+int llsend(const unsigned char *message, int length);
+
+// Function to send the batched messages and wait until they are all acknowledged.
+// Returns "1" on success or "-1" on error.
+int llflush();
+
+// Function to receive the next message sent with llsend (at most MAX_PACKET_SIZE - 2 bytes).
+// Returns the length of the message, "0" once the peer disconnects or "-1" on error.
+int llrecv(unsigned char *message);
+
+// Flow control: the acknowledgment of a frame delivered while no read is posted waits for the
+// owner to post its next read, which sends it as RR. If the owner is still handling the data
+// after ACK_GRACE_PERIOD (a SIGALRM timer), or an I-frame arrives while no read is posted, RNR
+// holds the transmitter's frames (polling every timeout) until RR or an I-frame announces that
+// a read was posted again. With a window of one frame, RR grants the single credit and RNR
+// withdraws it.
+// Every write to the serial port is paced by a token bucket filled at BAUDRATE / BITS_PER_BYTE
+// bytes per second, holding at most one frame, so the line is never fed faster than it drains.
+
 // Function to close a previously opened connection.
 // If showStatistics is TRUE, the Link Layer prints statistics in the console on close.
-// Returns "1" on success or "-1" on error.
+// The pending write and batched messages are delivered first.
+// Returns "1" on success or "-1" on error (including undelivered messages).
 int llclose(int showStatistics);
 
 
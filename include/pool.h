@@ -0,0 +1,33 @@
+// Fixed-size buffer pool header.
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+// Struct to store a pool of equally sized buffers carved out of a single arena.
+// Free buffers are chained through their first bytes, so taking and returning a
+// buffer never touches the heap.
+typedef struct {
+    unsigned char *arena;    // Single allocation holding every buffer
+    size_t bufferSize;       // Size of each buffer (rounded up to keep buffers aligned)
+    int capacity;            // Number of buffers in the arena
+    int available;           // Number of buffers currently free
+    void *freeList;          // First free buffer
+} Pool;
+
+// Function to create a pool of "capacity" buffers of at least "bufferSize" bytes.
+// Returns "1" on success or "-1" on error.
+int poolInit(Pool *pool, size_t bufferSize, int capacity);
+
+// Function to take a buffer from the pool.
+// Returns the buffer or NULL if the pool is exhausted.
+unsigned char *poolGet(Pool *pool);
+
+// Function to give a buffer back to the pool it was taken from.
+void poolPut(Pool *pool, unsigned char *buffer);
+
+// Function to release the arena of the pool.
+void poolDestroy(Pool *pool);
+
+#endif // _POOL_H_
@@ -0,0 +1,73 @@
+// Transport backend header.
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stdatomic.h>
+
+// Prefixes of the port name selecting a backend, anything else is a serial port:
+//   "unix:<path>"  UNIX-domain stream socket, the receiver listens on <path>.
+//   "shm:<name>"   Pair of lock-free rings in POSIX shared memory, created by the receiver.
+// The name is removed as soon as both ends are connected.
+#define TRANSPORT_UNIX_PREFIX "unix:"
+#define TRANSPORT_SHM_PREFIX "shm:"
+
+// Seconds the transmitter waits for the receiver's socket or shared memory to appear.
+#define TRANSPORT_CONNECT_TIMEOUT 10
+
+// Size of each shared-memory ring (a power of two).
+#define SHM_RING_SIZE 65536
+
+// Struct to store a single-producer single-consumer ring. Both counters only grow (modulo
+// 2^32) and double as futex words: the reader sleeps on head, the writer on tail.
+typedef struct {
+    _Atomic unsigned int head;   // Bytes written so far, only stored by the writer
+    _Atomic unsigned int tail;   // Bytes read so far, only stored by the reader
+    unsigned char data[SHM_RING_SIZE];
+} ShmRing;
+
+// Struct to store the shared-memory segment: one ring per direction.
+typedef struct {
+    ShmRing rings[2];            // Transmitter -> receiver, receiver -> transmitter
+} ShmSegment;
+
+typedef struct Transport Transport;
+
+// Struct to store the operations of a backend.
+typedef struct {
+    // Opens "address", as the listening side if "server" is TRUE. Serial ports set "baudRate"
+    // to the rate they run at. Returns "1" on success or "-1" on error.
+    int (*open)(Transport *transport, const char *address, int *baudRate, int server);
+    // Reads up to "size" available bytes without blocking. Returns the count (0 if none) or "-1".
+    int (*read)(Transport *transport, unsigned char *buf, int size);
+    // Writes all "size" bytes. Returns "size" or "-1" on error.
+    int (*write)(Transport *transport, const unsigned char *buf, int size);
+    // Waits up to "timeout" milliseconds (-1 forever) for input. Returns "1" if input is
+    // available, "0" on timeout or "-1" on error.
+    int (*wait)(Transport *transport, int timeout);
+    // Releases the backend.
+    int (*close)(Transport *transport);
+    int paced;                   // Flag to indicate writes must be paced to the baud rate
+} TransportOps;
+
+// Struct to store an open transport.
+struct Transport {
+    const TransportOps *ops;     // Backend operations
+    int fd;                      // Serial port or socket (-1 for shared memory)
+    ShmSegment *segment;         // Mapped shared memory
+    ShmRing *in;                 // Ring this end reads
+    ShmRing *out;                // Ring this end writes
+    char name[108];              // Socket path or shared memory name
+};
+
+// Function to open the backend selected by the prefix of "address".
+// Returns "1" on success or "-1" on error.
+int transportOpen(Transport *transport, const char *address, int *baudRate, int server);
+
+// Functions forwarding to the backend operations.
+int transportRead(Transport *transport, unsigned char *buf, int size);
+int transportWrite(Transport *transport, const unsigned char *buf, int size);
+int transportWait(Transport *transport, int timeout);
+int transportClose(Transport *transport);
+
+#endif // _TRANSPORT_H_
@@ -2,6 +2,10 @@
 
 #include "application_layer.h"
 #include "link_layer.h"
+#include "delta.h"
+#include "chunk_store.h"
+#include "hash.h"
+#include "channel.h"
 #include <string.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -11,15 +15,906 @@
 #include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/mman.h>
+
+// Room for the body of any packet, once its 4-byte header is scattered apart.
+#define PACKET_BODY_SIZE (MAX_PACKET_SIZE - 4)
+
+// Packet types of the delta transfer mode (1, 2 and 3 are data, start and end)
+#define PACKET_SIGNATURES 4      // Receiver -> transmitter: block signatures of the old file
+#define PACKET_SIGNATURES_END 5  // Receiver -> transmitter: no more signatures
+#define PACKET_COPY 6            // Transmitter -> receiver: copy blocks of the old file
+
+// Packet types of the chunk cache mode
+#define PACKET_CHUNK_LIST 7      // Transmitter -> receiver: hash and length of every chunk
+#define PACKET_CHUNK_LIST_END 8  // Transmitter -> receiver: no more chunks
+#define PACKET_CHUNK_HAVE 9      // Receiver -> transmitter: bitmap of the chunks already stored
+
+// Packet type of a run of zero bytes, sent as its offset and length (8 bytes each)
+#define PACKET_HOLE 10
+
+// Channel of the progress reports, which cut ahead of the bulk data (sent every STATUS_INTERVAL seconds)
+#define CHANNEL_STATUS 1
+#define STATUS_PRIORITY 1
+#define STATUS_INTERVAL 1
+
+// TLV of the start packet listing the requested transfer options (T = 2)
+#define TLV_OPTIONS 2
+#define OPTION_DELTA 0x01
+#define OPTION_CACHE 0x02
+
+// TLV of the end packet carrying the xxHash64 of the whole file (T = 3)
+#define TLV_HASH 3
+
+// Chunks listed by each chunk list packet, after its 2-byte header: hash (8) and length (4)
+#define CHUNKS_PER_PACKET ((MAX_PAYLOAD_SIZE - 2) / 12 > 255 ? 255 : (MAX_PAYLOAD_SIZE - 2) / 12)
+
+// Chunks covered by each bitmap packet, after its 3-byte header
+#define HAVE_BITS_PER_PACKET ((MAX_PAYLOAD_SIZE - 3) * 8)
+
+// Signatures carried by each signatures packet, after its 8-byte header
+#define SIGNATURES_PER_PACKET ((MAX_PAYLOAD_SIZE - 8) / DELTA_SIGNATURE_SIZE > 255 ? 255 : (MAX_PAYLOAD_SIZE - 8) / DELTA_SIGNATURE_SIZE)
+
+// Bytes spent per data packet besides its payload: frame (6), packet header (4) and its single
+// RR (5); RNR only adds to it when the receiver falls behind
+#define PACKET_OVERHEAD 15
+
+// State of the adaptive data payload size
+typedef struct {
+    int size;                    // Payload size of the next data packet
+    double frameErrorRate;       // Moving average of the failed transmission attempts
+    LinkStatistics last;         // Link statistics at the previous update
+} PayloadSizer;
+
+// Function to compute the integer square root of "value".
+unsigned long isqrt(unsigned long value) {
+    unsigned long root = 0, bit = 1UL << (sizeof(unsigned long) * 8 - 2);
+    while (bit > value) bit >>= 2;
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else root >>= 1;
+        bit >>= 2;
+    }
+    return root;
+}
+
+// Function to start adapting the payload size from INITIAL_PAYLOAD_SIZE.
+void payloadSizerInit(PayloadSizer *sizer) {
+    sizer->size = INITIAL_PAYLOAD_SIZE;
+    sizer->frameErrorRate = 0;
+    llgetStatistics(&sizer->last);
+}
+
+// Function to update the payload size after a data packet was acknowledged.
+// A frame of L bytes on a line with byte error rate p succeeds with probability
+// (1 - p)^L, which puts the most efficient payload near sqrt(overhead / p).
+void payloadSizerUpdate(PayloadSizer *sizer) {
+    LinkStatistics now;
+    llgetStatistics(&now);
+
+    // Every rejection or timeout is a failed attempt, followed by the successful one
+    int failures = (now.rejections - sizer->last.rejections) + (now.timeouts - sizer->last.timeouts);
+    sizer->last = now;
+    for (int i = 0; i <= failures; i++)
+        sizer->frameErrorRate += ((i < failures) - sizer->frameErrorRate) / 8;
+
+    // Per-byte error rate seen at the current frame length (small-rate approximation)
+    unsigned long target = MAX_PAYLOAD_SIZE;
+    double byteErrorRate = sizer->frameErrorRate / (sizer->size + PACKET_OVERHEAD);
+    if (byteErrorRate > 0) {
+        double optimal = PACKET_OVERHEAD / byteErrorRate;
+        if (optimal < (double) MAX_PAYLOAD_SIZE * MAX_PAYLOAD_SIZE) target = isqrt((unsigned long) optimal);
+    }
+    if (target < MIN_PAYLOAD_SIZE) target = MIN_PAYLOAD_SIZE;
+
+    // Move halfway towards the target, so a single error does not collapse the size
+    sizer->size = (sizer->size + target + 1) / 2;
+    if (sizer->size > MAX_PAYLOAD_SIZE) sizer->size = MAX_PAYLOAD_SIZE;
+}
+
+// State of the outgoing file in a full-duplex session
+typedef struct {
+    FILE *file;                  // File being sent
+    const char *filename;        // Name announced in the control packets
+    long int size;               // Size of the file
+    long int left;               // Bytes not yet sent
+    unsigned char sequence;      // Sequence number of the next data packet
+    PayloadSizer sizer;          // Adaptive payload size
+    unsigned char header[4];     // Header of the data packet in flight
+    unsigned char *chunk;        // Pooled buffer holding the payload in flight
+    unsigned char *control;      // Control packet in flight (NULL if none)
+    int endSent;                 // Flag to indicate the end packet was submitted
+    int done;                    // Flag to indicate the end packet was acknowledged
+} DuplexSender;
+
+// State of the incoming file in a full-duplex session
+typedef struct {
+    FILE *file;                  // File being received (NULL until the start packet arrives)
+    const char *filename;        // Name of the file to write
+    unsigned char header[4];     // Header of the packet being received
+    unsigned char *body;         // Pooled buffer receiving the packet body
+    int ended;                   // Flag to indicate the end packet arrived
+    int closed;                  // Flag to indicate the transmitter disconnected
+} DuplexReceiver;
+
+// Function to submit the next packet of the outgoing file.
+void duplexSendNext(DuplexSender *sender);
+
+// Completion callback of every write of the outgoing file.
+void duplexWriteDone(int result, void *context) {
+    DuplexSender *sender = (DuplexSender *) context;
+
+    if (result < 0) {
+        printf("An error occurred sending %s\n", sender->filename);
+        exit(-1);
+    }
+    int wasData = (sender->control == NULL);
+    free(sender->control);
+    sender->control = NULL;
+
+    if (sender->endSent) sender->done = TRUE;
+    else {
+        if (wasData) payloadSizerUpdate(&sender->sizer);
+        duplexSendNext(sender);
+    }
+}
+
+// Function to submit the next packet of the outgoing file.
+void duplexSendNext(DuplexSender *sender) {
+    unsigned int controlPacketSize;
+
+    // Data packets until the file is exhausted, then the end packet
+    if (sender->left > 0) {
+        int size_of_data = (sender->left > sender->sizer.size) ? sender->sizer.size : sender->left;
+        if (fread(sender->chunk, sizeof(unsigned char), size_of_data, sender->file) != size_of_data) {
+            printf("An error occurred reading the file\n");
+            exit(-1);
+        }
+
+        sender->header[0] = 1; // Data packet type
+        sender->header[1] = sender->sequence; // Packet sequence number
+        sender->header[2] = size_of_data >> 8 & 0xFF; // High byte of size_of_data
+        sender->header[3] = size_of_data & 0xFF; // Low byte of size_of_data
+
+        struct iovec packet[2] = {{sender->header, 4}, {sender->chunk, size_of_data}};
+        if (llwritevAsync(packet, 2, duplexWriteDone, sender) < 0) {
+            printf("An error occurred in the data Packet\n");
+            exit(-1);
+        }
+
+        sender->left -= size_of_data;
+        sender->sequence = (sender->sequence + 1) % 255;
+        printf("Sent Packet with %d bytes --- %ld left to be sent! \n", 4 + size_of_data, sender->left);
+    }
+    else {
+        sender->control = createControlPacket(3, sender->filename, sender->size, &controlPacketSize);
+        sender->endSent = TRUE;
+        if (llwriteAsync(sender->control, controlPacketSize, duplexWriteDone, sender) < 0) {
+            printf("An error occurred in the end Packet\n");
+            exit(-1);
+        }
+    }
+}
+
+// Function to post the read for the next packet of the incoming file.
+void duplexReceiveNext(DuplexReceiver *receiver);
+
+// Completion callback of every read of the incoming file.
+void duplexReadDone(int result, void *context) {
+    DuplexReceiver *receiver = (DuplexReceiver *) context;
+
+    // Disconnection requested by the transmitter
+    if (result == 0) {
+        receiver->closed = TRUE;
+        return;
+    }
+
+    if (result > 0) {
+        switch (receiver->header[0]) {
+            case 2:
+                // Start packet: the file is created when the peer announces it
+                if (receiver->file == NULL) receiver->file = fopen(receiver->filename, "wb+");
+                break;
+            case 1:
+                if (receiver->file != NULL)
+                    fwrite(receiver->body, sizeof(unsigned char), result - 4, receiver->file);
+                break;
+            case 3:
+                if (receiver->file != NULL) fclose(receiver->file);
+                receiver->file = NULL;
+                receiver->ended = TRUE;
+                break;
+        }
+    }
+
+    // Keep a read posted until the transmitter disconnects
+    duplexReceiveNext(receiver);
+}
+
+// Function to post the read for the next packet of the incoming file.
+void duplexReceiveNext(DuplexReceiver *receiver) {
+    struct iovec segments[2] = {{receiver->header, 4}, {receiver->body, PACKET_BODY_SIZE}};
+    if (llreadvAsync(segments, 2, duplexReadDone, receiver) < 0) {
+        printf("An error occurred posting a read\n");
+        exit(-1);
+    }
+}
+
+// Function to send one file and receive another over the same link session.
+void applicationLayerDuplex(const char *serialPort, const char *role, int baudRate,
+                            int nTries, int timeout, const char *sendFilename,
+                            const char *receiveFilename) {
+
+    // Define and initialize link layer connection parameters
+    LinkLayer connectionParameters;
+    strcpy(connectionParameters.serialPort, serialPort);
+    connectionParameters.role = (strcmp(role, "tx") != 0) ? receiver : transmitter; // Compare the role string
+    connectionParameters.baudRate = baudRate;
+    connectionParameters.nRetransmissions = nTries;
+    connectionParameters.timeout = timeout;
+
+    // Open the outgoing file before connecting, to fail early
+    FILE *file = fopen(sendFilename, "rb");
+    if (file == NULL) {
+        perror("File not found\n");
+        exit(-1);
+    }
+    fseek(file, 0L, SEEK_END);
+    long int f_size = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    // Establish a connection using link layer
+    if (llopen(connectionParameters) < 0) {
+        perror("Connection error\n");
+        exit(-1);
+    }
+
+    DuplexSender sender = {file, sendFilename, f_size, f_size, 0, {0}, {0}, llgetPacket(), NULL, FALSE, FALSE};
+    payloadSizerInit(&sender.sizer);
+    DuplexReceiver receiverState = {NULL, receiveFilename, {0}, llgetPacket(), FALSE, FALSE};
+
+    // Both directions run at once: acknowledgments ride on the I-frames flowing the other way
+    unsigned int controlPacketSize;
+    sender.control = createControlPacket(2, sendFilename, f_size, &controlPacketSize);
+    if (llwriteAsync(sender.control, controlPacketSize, duplexWriteDone, &sender) < 0) {
+        printf("An error occurred in the start Packet\n");
+        exit(-1);
+    }
+    duplexReceiveNext(&receiverState);
+
+    // The transmitter closes the link once both files are through, the receiver waits for it
+    while (connectionParameters.role == transmitter ? !(sender.done && receiverState.ended) : !receiverState.closed) {
+        llpoll(llnextDeadline());
+        if (llprocess() < 0) {
+            printf("An error occurred on the link\n");
+            exit(-1);
+        }
+    }
+
+    fclose(file);
+    if (receiverState.file != NULL) fclose(receiverState.file);
+    llputPacket(sender.chunk);
+    llputPacket(receiverState.body);
+
+    if (connectionParameters.role == transmitter) llclose(1);
+}
+
+// Function to send the lines of a file as separate records, or to receive them.
+void applicationLayerRecords(const char *serialPort, const char *role, int baudRate,
+                             int nTries, int timeout, const char *filename) {
+
+    // Define and initialize link layer connection parameters
+    LinkLayer connectionParameters;
+    strcpy(connectionParameters.serialPort, serialPort);
+    connectionParameters.role = (strcmp(role, "tx") != 0) ? receiver : transmitter; // Compare the role string
+    connectionParameters.baudRate = baudRate;
+    connectionParameters.nRetransmissions = nTries;
+    connectionParameters.timeout = timeout;
+
+    int streaming = (strcmp(filename, "-") == 0);
+    FILE *file = streaming ? (connectionParameters.role == transmitter ? stdin : stdout)
+                           : fopen(filename, connectionParameters.role == transmitter ? "rb" : "wb");
+    if (file == NULL) {
+        perror("File not found\n");
+        exit(-1);
+    }
+
+    // Establish a connection using link layer
+    if (llopen(connectionParameters) < 0) {
+        perror("Connection error\n");
+        exit(-1);
+    }
+
+    unsigned char record[MAX_PACKET_SIZE];
+    long int records = 0;
+    if (connectionParameters.role == transmitter) {
+
+        // Each line goes on its own, the link layer packs them into shared frames
+        while (fgets((char *) record, MAX_PACKET_SIZE - 2, file) != NULL) {
+            int length = strcspn((char *) record, "\n");
+            if (length == 0) continue;
+            if (llsend(record, length) < 0) {
+                printf("An error occurred sending record %ld\n", records);
+                exit(-1);
+            }
+            records++;
+        }
+        if (llflush() < 0) {
+            printf("An error occurred flushing the records\n");
+            exit(-1);
+        }
+        printf("%ld records sent\n", records);
+        llclose(1);
+    }
+    else {
+        int length;
+        while ((length = llrecv(record)) > 0) {
+            fwrite(record, 1, length, file);
+            fputc('\n', file);
+            records++;
+        }
+        if (length < 0) {
+            printf("An error occurred receiving record %ld\n", records);
+            exit(-1);
+        }
+        printf("%ld records received\n", records);
+    }
+
+    if (!streaming) fclose(file);
+    else fflush(file);
+}
+
+// Function to read the next packet, giving up once the link has failed.
+// Returns the size of the packet, or 0 once the peer disconnects.
+int readPacket(unsigned char *packet) {
+    int packetSize = llread(packet);
+    if (packetSize < 0) {
+        printf("An error occurred on the link\n");
+        exit(-1);
+    }
+    return packetSize;
+}
+
+// Function to check whether "option" follows the role, as in "tx,delta".
+int hasRoleOption(const char *role, const char *option) {
+    size_t length = strlen(option);
+    for (const char *p = strchr(role, ','); p != NULL; p = strchr(p + 1, ',')) {
+        if (strncmp(p + 1, option, length) == 0 && (p[1 + length] == ',' || p[1 + length] == '\0'))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Function to send "length" bytes of "data" as data packets, straight from memory.
+void sendDataPackets(const unsigned char *data, long int length, unsigned char *sequence, PayloadSizer *sizer) {
+    while (length > 0) {
+        int size_of_data = (length > sizer->size) ? sizer->size : length;
+        unsigned char header[4] = {1, *sequence, size_of_data >> 8 & 0xFF, size_of_data & 0xFF};
+        struct iovec packet[2] = {{header, 4}, {(void *) data, size_of_data}};
+
+        if (llwritev(packet, 2) == -1) {
+            printf("An error occurred in the data Packet\n");
+            exit(-1);
+        }
+
+        payloadSizerUpdate(sizer);
+        data += size_of_data;
+        length -= size_of_data;
+        printf("Sent Packet with %d bytes --- %ld left in this run! \n", 4 + size_of_data, length);
+        *sequence = (*sequence + 1) % 255;
+    }
+}
+
+// Function to print a progress report received on the status channel.
+void printStatus(unsigned char channel, const unsigned char *data, int length, void *context) {
+    printf("[channel %d] %.*s\n", channel, length, (const char *) data);
+}
+
+// Function to check whether "length" bytes are all zero.
+// Comparing the buffer with itself shifted by one byte lets the (vectorized) memcmp do the scan.
+int isZeroRun(const unsigned char *data, size_t length) {
+    return length == 0 || (data[0] == 0 && memcmp(data, data + 1, length - 1) == 0);
+}
+
+// Function to send a run of "length" zero bytes starting at "offset" of the file.
+void sendHole(long int offset, long int length, unsigned char *sequence) {
+    unsigned char packet[20] = {PACKET_HOLE, *sequence, 0, 16};
+    for (int b = 0; b < 8; b++) {
+        packet[4 + b] = offset >> (56 - 8 * b) & 0xFF;
+        packet[12 + b] = length >> (56 - 8 * b) & 0xFF;
+    }
+
+    if (llwrite(packet, 20) == -1) {
+        printf("An error occurred in the hole Packet\n");
+        exit(-1);
+    }
+    printf("Sent hole of %ld zero bytes at %ld\n", length, offset);
+    *sequence = (*sequence + 1) % 255;
+}
+
+// Function to send a reference to "count" blocks of the receiver's old file, from "first" on.
+void sendBlockCopy(unsigned int first, int count, unsigned char *sequence) {
+    unsigned char packet[8] = {PACKET_COPY, *sequence, count >> 8 & 0xFF, count & 0xFF,
+                               first >> 24 & 0xFF, first >> 16 & 0xFF, first >> 8 & 0xFF, first & 0xFF};
+
+    if (llwrite(packet, 8) == -1) {
+        printf("An error occurred in the copy Packet\n");
+        exit(-1);
+    }
+    printf("Sent reference to %d blocks from block %u\n", count, first);
+    *sequence = (*sequence + 1) % 255;
+}
+
+// Function to receive the block signatures of the receiver's old file into "index".
+// Returns the number of signatures (0 if the receiver has no old file) or -1 on error.
+int receiveSignatures(SignatureIndex *index) {
+    unsigned char *packet = llgetPacket();
+    int packetSize, total = 0, ready = FALSE;
+
+    while (1) {
+        packetSize = readPacket(packet);
+        if (packetSize == 0 || packet[0] == PACKET_SIGNATURES_END) break;
+        if (packet[0] != PACKET_SIGNATURES || packetSize < 8) continue;
+
+        // The first packet announces the block size and the number of blocks
+        if (!ready) {
+            int blockSize = packet[1] << 8 | packet[2];
+            total = packet[3] << 24 | packet[4] << 16 | packet[5] << 8 | packet[6];
+            if (signatureIndexInit(index, blockSize, total) < 0) {
+                llputPacket(packet);
+                return -1;
+            }
+            ready = TRUE;
+        }
+
+        // Each signature is the weak checksum (4 bytes) followed by the strong one (8 bytes),
+        // and only those the packet really holds are read, whatever its count says
+        for (int k = 0; k < packet[7] && index->count < total &&
+                        8 + (k + 1) * DELTA_SIGNATURE_SIZE <= packetSize; k++) {
+            const unsigned char *entry = packet + 8 + k * DELTA_SIGNATURE_SIZE;
+            unsigned int weak = entry[0] << 24 | entry[1] << 16 | entry[2] << 8 | entry[3];
+            unsigned long long strong = 0;
+            for (int b = 4; b < DELTA_SIGNATURE_SIZE; b++)
+                strong = strong << 8 | entry[b];
+            signatureIndexAdd(index, weak, strong);
+        }
+    }
+
+    llputPacket(packet);
+    return ready ? index->count : 0;
+}
+
+// Function to send "file" as literal runs and references to the receiver's old blocks.
+// Returns TRUE if the file was sent, or FALSE if the receiver has nothing to reuse.
+int sendFileDelta(FILE *file, long int f_size, unsigned char *sequence, PayloadSizer *sizer, FileHash *fileHash) {
+    SignatureIndex index;
+    int signatures = receiveSignatures(&index);
+    if (signatures < 0) {
+        printf("An error occurred receiving the signatures\n");
+        exit(-1);
+    }
+    if (signatures == 0) return FALSE;
+
+    int blockSize = index.blockSize;
+    if (f_size < blockSize) {
+        signatureIndexDestroy(&index);
+        return FALSE;
+    }
+
+    const unsigned char *data = mmap(NULL, f_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (data == MAP_FAILED) {
+        signatureIndexDestroy(&index);
+        return FALSE;
+    }
+    fileHashUpdate(fileHash, data, f_size);
+
+    // Slide a window over the file: matched blocks become references, the rest literal runs
+    RollingChecksum checksum;
+    unsigned int weak = rollingInit(&checksum, data, blockSize);
+    long int pos = 0, literal = 0;
+    int runStart = -1, runCount = 0;
+
+    while (pos + blockSize <= f_size) {
+        int block = signatureIndexFind(&index, weak, data + pos, (runStart >= 0) ? runStart + runCount : -1);
+
+        if (block >= 0) {
+            // Literal bytes before the match go out first, after the run that preceded them
+            if (literal < pos) {
+                if (runStart >= 0) sendBlockCopy(runStart, runCount, sequence);
+                runStart = -1;
+                sendDataPackets(data + literal, pos - literal, sequence, sizer);
+            }
+
+            // Consecutive blocks extend the current run
+            if (runStart >= 0 && block == runStart + runCount && runCount < 0xFFFF) runCount++;
+            else {
+                if (runStart >= 0) sendBlockCopy(runStart, runCount, sequence);
+                runStart = block;
+                runCount = 1;
+            }
+
+            pos += blockSize;
+            literal = pos;
+            if (pos + blockSize <= f_size) weak = rollingInit(&checksum, data + pos, blockSize);
+        }
+        else {
+            if (pos + blockSize < f_size) weak = rollingRoll(&checksum, data[pos], data[pos + blockSize]);
+            pos++;
+        }
+    }
+
+    if (runStart >= 0) sendBlockCopy(runStart, runCount, sequence);
+    sendDataPackets(data + literal, f_size - literal, sequence, sizer);
+
+    munmap((void *) data, f_size);
+    signatureIndexDestroy(&index);
+    return TRUE;
+}
+
+// Function to send the block signatures of "basis" (NULL if there is no old file).
+// Returns the block size used, or 0 if no signatures were sent.
+int sendSignatures(FILE *basis) {
+    unsigned char end = PACKET_SIGNATURES_END;
+    int blockSize = 0;
+
+    if (basis != NULL) {
+        fseek(basis, 0L, SEEK_END);
+        long int basisSize = ftell(basis);
+        fseek(basis, 0L, SEEK_SET);
+
+        blockSize = deltaBlockSize(basisSize);
+        unsigned int total = basisSize / blockSize;
+        unsigned char *block = (unsigned char *) malloc(blockSize);
+        unsigned char *packet = llgetPacket();
+        int count = 0;
+
+        // Only whole blocks are signed, a trailing partial block is always resent
+        for (unsigned int n = 0; n < total; n++) {
+            if (fread(block, 1, blockSize, basis) != blockSize) break;
+
+            RollingChecksum checksum;
+            unsigned int weak = rollingInit(&checksum, block, blockSize);
+            unsigned long long strong = strongChecksum(block, blockSize);
+            unsigned char *entry = packet + 8 + count * DELTA_SIGNATURE_SIZE;
+            for (int b = 0; b < 4; b++)
+                entry[b] = weak >> (24 - 8 * b) & 0xFF;
+            for (int b = 0; b < 8; b++)
+                entry[4 + b] = strong >> (56 - 8 * b) & 0xFF;
+            count++;
+
+            // Flush the packet when it is full or this was the last block
+            if (count == SIGNATURES_PER_PACKET || n == total - 1) {
+                packet[0] = PACKET_SIGNATURES;
+                packet[1] = blockSize >> 8 & 0xFF;
+                packet[2] = blockSize & 0xFF;
+                packet[3] = total >> 24 & 0xFF;
+                packet[4] = total >> 16 & 0xFF;
+                packet[5] = total >> 8 & 0xFF;
+                packet[6] = total & 0xFF;
+                packet[7] = count;
+                if (llwrite(packet, 8 + count * DELTA_SIGNATURE_SIZE) == -1) {
+                    printf("An error occurred in the signatures Packet\n");
+                    exit(-1);
+                }
+                count = 0;
+            }
+        }
+
+        free(block);
+        llputPacket(packet);
+        if (total == 0) blockSize = 0;
+    }
+
+    if (llwrite(&end, 1) == -1) {
+        printf("An error occurred in the signatures end Packet\n");
+        exit(-1);
+    }
+    return blockSize;
+}
+
+// Function to send "file" cut into content-defined chunks, skipping those the receiver has.
+// Returns TRUE once the file was sent.
+int sendFileChunked(FILE *file, long int f_size, unsigned char *sequence, PayloadSizer *sizer, FileHash *fileHash) {
+    const unsigned char *data = NULL;
+    if (f_size > 0) {
+        data = mmap(NULL, f_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (data == MAP_FAILED) {
+            printf("An error occurred mapping the file\n");
+            exit(-1);
+        }
+    }
+
+    // Cut the file and list every chunk to the receiver
+    int count = 0, capacity = 0;
+    long int *offsets = NULL;
+    unsigned char *packet = llgetPacket();
+    int listed = 0;
+
+    for (long int pos = 0; pos < f_size; ) {
+        size_t length = chunkBoundary(data + pos, f_size - pos);
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            offsets = (long int *) realloc(offsets, (capacity + 1) * sizeof(long int));
+        }
+        offsets[count++] = pos;
+
+        unsigned long long hash = strongChecksum(data + pos, length);
+        fileHashUpdate(fileHash, data + pos, length);
+        unsigned char *entry = packet + 2 + listed * 12;
+        for (int b = 0; b < 8; b++)
+            entry[b] = hash >> (56 - 8 * b) & 0xFF;
+        for (int b = 0; b < 4; b++)
+            entry[8 + b] = length >> (24 - 8 * b) & 0xFF;
+        listed++;
+        pos += length;
+
+        if (listed == CHUNKS_PER_PACKET || pos == f_size) {
+            packet[0] = PACKET_CHUNK_LIST;
+            packet[1] = listed;
+            if (llwrite(packet, 2 + listed * 12) == -1) {
+                printf("An error occurred in the chunk list Packet\n");
+                exit(-1);
+            }
+            listed = 0;
+        }
+    }
+    if (offsets != NULL) offsets[count] = f_size;
+
+    unsigned char end = PACKET_CHUNK_LIST_END;
+    if (llwrite(&end, 1) == -1) {
+        printf("An error occurred in the chunk list end Packet\n");
+        exit(-1);
+    }
+
+    // Collect the bitmap of the chunks the receiver already stores
+    unsigned char *have = (unsigned char *) calloc(count / 8 + 1, 1);
+    int known = 0, packetSize;
+    while (known < count) {
+        packetSize = readPacket(packet);
+        if (packetSize == 0) exit(-1);
+        if (packet[0] != PACKET_CHUNK_HAVE || packetSize < 3) continue;
+
+        int bits = packet[1] << 8 | packet[2];
+        for (int k = 0; k < bits && known < count; k++, known++) {
+            if (packet[3 + k / 8] & (0x80 >> (k % 8))) have[known / 8] |= 0x80 >> (known % 8);
+        }
+    }
+    llputPacket(packet);
+
+    // Send runs of missing chunks as ordinary data packets
+    int reused = 0;
+    for (int c = 0; c < count; ) {
+        if (have[c / 8] & (0x80 >> (c % 8))) {
+            reused++;
+            c++;
+            continue;
+        }
+        int last = c;
+        while (last + 1 < count && !(have[(last + 1) / 8] & (0x80 >> ((last + 1) % 8)))) last++;
+        sendDataPackets(data + offsets[c], offsets[last + 1] - offsets[c], sequence, sizer);
+        c = last + 1;
+    }
+    printf("Reused %d of %d chunks from the receiver's store\n", reused, count);
+
+    free(have);
+    free(offsets);
+    if (data != NULL) munmap((void *) data, f_size);
+    return TRUE;
+}
+
+// State of the file being received: every byte is counted and hashed on its way to disk
+typedef struct {
+    FILE *file;                  // File being written
+    long int written;            // Bytes written so far
+    FileHash hash;               // Hash of the bytes written so far
+    int seekedPast;              // Flag to indicate the last bytes were seeked over, not written
+} OutputFile;
+
+// Function to append "length" bytes to the received file.
+void writeOutput(OutputFile *output, const unsigned char *data, size_t length) {
+    output->seekedPast = FALSE;
+    fwrite(data, sizeof(unsigned char), length, output->file);
+    fileHashUpdate(&output->hash, data, length);
+    output->written += length;
+}
+
+// Function to end the received file. A trailing hole was only seeked over, whether the file
+// is named or a redirected standard output, so its last zero byte is written to extend it.
+void finishOutput(OutputFile *output) {
+    if (!output->seekedPast) return;
+    static const unsigned char zero = 0;
+    if (fseek(output->file, -1, SEEK_CUR) != 0 || fwrite(&zero, 1, 1, output->file) != 1)
+        perror("Trailing hole");
+    output->seekedPast = FALSE;
+}
+
+// Function to append a run of "length" zero bytes to the received file.
+// Seeking past them leaves a hole in the file, streams get the zero bytes written out.
+void writeHole(OutputFile *output, long int length) {
+    static const unsigned char zeros[4096];
+    int seekable = (fseek(output->file, length, SEEK_CUR) == 0);
+    if (seekable) output->seekedPast = TRUE;
+
+    while (length > 0) {
+        size_t n = (length > sizeof(zeros)) ? sizeof(zeros) : length;
+        if (!seekable) fwrite(zeros, sizeof(unsigned char), n, output->file);
+        fileHashUpdate(&output->hash, zeros, n);
+        output->written += n;
+        length -= n;
+    }
+}
+
+// State of the receiving end of the chunk cache mode
+typedef struct {
+    ChunkStore store;            // Persistent chunk store
+    int storeOpen;               // Flag to indicate the store could be opened
+    OutputFile *output;          // File being rebuilt
+    int count;                   // Number of chunks of the file
+    unsigned long long *hashes;  // Hash of each chunk
+    unsigned int *lengths;       // Length of each chunk
+    unsigned long long *offsets; // Offset of each stored chunk in the store
+    unsigned char *have;         // Flag per chunk: already in the store
+    int current;                 // Chunk being rebuilt
+    unsigned int filled;         // Bytes of the current chunk received so far
+    unsigned long long hash;     // Running hash of the current chunk
+    unsigned char *buffer;       // Pooled buffer used to copy stored chunks
+} ChunkReceiver;
+
+// Function to write the stored chunks from the current one on, up to the next missing chunk.
+void chunkReceiverCopyStored(ChunkReceiver *chunks) {
+    while (chunks->current < chunks->count && chunks->have[chunks->current]) {
+        unsigned long long offset = chunks->offsets[chunks->current];
+        unsigned int left = chunks->lengths[chunks->current];
+        while (left > 0) {
+            unsigned int n = (left > MAX_PACKET_SIZE) ? MAX_PACKET_SIZE : left;
+            if (chunkStoreRead(&chunks->store, offset, chunks->buffer, n) < 0) {
+                printf("An error occurred reading the chunk store\n");
+                exit(-1);
+            }
+            writeOutput(chunks->output, chunks->buffer, n);
+            offset += n;
+            left -= n;
+        }
+        chunks->current++;
+    }
+}
+
+// Function to receive the chunk list, answer with the bitmap of stored chunks and write
+// the stored chunks that open the file.
+void chunkReceiverStart(ChunkReceiver *chunks, OutputFile *output, unsigned char *packet) {
+    memset(chunks, 0, sizeof(*chunks));
+    chunks->output = output;
+    chunks->storeOpen = chunkStoreOpen(&chunks->store, CHUNK_STORE_PATH) > 0;
+    chunks->buffer = llgetPacket();
+    if (!chunks->storeOpen) printf("Chunk store unavailable, receiving every chunk\n");
+
+    int capacity = 0, packetSize;
+    while (1) {
+        packetSize = readPacket(packet);
+        if (packetSize == 0 || packet[0] == PACKET_CHUNK_LIST_END) break;
+        if (packet[0] != PACKET_CHUNK_LIST) continue;
+
+        for (int k = 0; k < packet[1] && 2 + (k + 1) * 12 <= packetSize; k++) {
+            const unsigned char *entry = packet + 2 + k * 12;
+            if (chunks->count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                chunks->hashes = (unsigned long long *) realloc(chunks->hashes, capacity * sizeof(unsigned long long));
+                chunks->lengths = (unsigned int *) realloc(chunks->lengths, capacity * sizeof(unsigned int));
+                chunks->offsets = (unsigned long long *) realloc(chunks->offsets, capacity * sizeof(unsigned long long));
+                chunks->have = (unsigned char *) realloc(chunks->have, capacity);
+            }
+            unsigned long long hash = 0;
+            for (int b = 0; b < 8; b++)
+                hash = hash << 8 | entry[b];
+            int c = chunks->count++;
+            chunks->hashes[c] = hash;
+            chunks->lengths[c] = entry[8] << 24 | entry[9] << 16 | entry[10] << 8 | entry[11];
+
+            unsigned int storedLength = 0;
+            chunks->have[c] = chunks->storeOpen &&
+                              chunkStoreFind(&chunks->store, hash, &chunks->offsets[c], &storedLength) &&
+                              storedLength == chunks->lengths[c];
+        }
+    }
+
+    // Answer with one bit per chunk
+    for (int first = 0; first < chunks->count; first += HAVE_BITS_PER_PACKET) {
+        int bits = (chunks->count - first > HAVE_BITS_PER_PACKET) ? HAVE_BITS_PER_PACKET : chunks->count - first;
+        memset(packet, 0, 3 + (bits + 7) / 8);
+        packet[0] = PACKET_CHUNK_HAVE;
+        packet[1] = bits >> 8 & 0xFF;
+        packet[2] = bits & 0xFF;
+        for (int k = 0; k < bits; k++) {
+            if (chunks->have[first + k]) packet[3 + k / 8] |= 0x80 >> (k % 8);
+        }
+        if (llwrite(packet, 3 + (bits + 7) / 8) == -1) {
+            printf("An error occurred in the chunk bitmap Packet\n");
+            exit(-1);
+        }
+    }
+
+    chunks->hash = STRONG_CHECKSUM_INIT;
+    chunkReceiverCopyStored(chunks);
+}
+
+// Function to consume the body of a data packet, which continues the missing chunks in order.
+void chunkReceiverData(ChunkReceiver *chunks, const unsigned char *data, int length) {
+    while (length > 0 && chunks->current < chunks->count) {
+        unsigned int take = chunks->lengths[chunks->current] - chunks->filled;
+        if (take > length) take = length;
+
+        writeOutput(chunks->output, data, take);
+        if (chunks->storeOpen && chunkStoreAppend(&chunks->store, data, take) < 0) {
+            chunkStoreRollback(&chunks->store, chunks->filled);
+            chunks->storeOpen = FALSE;
+        }
+        chunks->hash = strongChecksumUpdate(chunks->hash, data, take);
+        chunks->filled += take;
+        data += take;
+        length -= take;
+
+        // A complete chunk is indexed, if it hashes as announced
+        if (chunks->filled == chunks->lengths[chunks->current]) {
+            if (chunks->storeOpen) {
+                if (chunks->hash == chunks->hashes[chunks->current])
+                    chunkStoreCommit(&chunks->store, chunks->hash, chunks->filled);
+                else chunkStoreRollback(&chunks->store, chunks->filled);
+            }
+            chunks->current++;
+            chunks->filled = 0;
+            chunks->hash = STRONG_CHECKSUM_INIT;
+            chunkReceiverCopyStored(chunks);
+        }
+    }
+}
+
+// Function to close the store and release the chunk tables.
+void chunkReceiverFinish(ChunkReceiver *chunks) {
+    if (chunks->storeOpen) chunkStoreClose(&chunks->store);
+    llputPacket(chunks->buffer);
+    free(chunks->hashes);
+    free(chunks->lengths);
+    free(chunks->offsets);
+    free(chunks->have);
+}
 
 // Function to establish a connection and handle data transfer
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename) {
 
+    // Options follow the role after commas (e.g. "tx,delta")
+    char baseRole[8] = {0};
+    strncpy(baseRole, role, strcspn(role, ",") < sizeof(baseRole) - 1 ? strcspn(role, ",") : sizeof(baseRole) - 1);
+    llsetFraming(hasRoleOption(role, "cobs") ? FRAMING_COBS : FRAMING_STUFFING);
+
+    // Full-duplex roles take "<file to send>:<file to receive>"
+    if (strcmp(baseRole, "txrx") == 0 || strcmp(baseRole, "rxtx") == 0) {
+        char sendFilename[256];
+        const char *separator = strchr(filename, ':');
+        if (separator == NULL || separator - filename >= sizeof(sendFilename)) {
+            printf("Full-duplex roles expect <file to send>:<file to receive>\n");
+            exit(-1);
+        }
+        memcpy(sendFilename, filename, separator - filename);
+        sendFilename[separator - filename] = '\0';
+        applicationLayerDuplex(serialPort, (role[0] == 't') ? "tx" : "rx", baudRate, nTries, timeout,
+                               sendFilename, separator + 1);
+        return;
+    }
+
+    // The records option sends every line of the file as a message of its own
+    if (hasRoleOption(role, "records")) {
+        applicationLayerRecords(serialPort, baseRole, baudRate, nTries, timeout, filename);
+        return;
+    }
+
     // Define and initialize link layer connection parameters
     LinkLayer connectionParameters;
     strcpy(connectionParameters.serialPort, serialPort);
-    connectionParameters.role = (strcmp(role, "tx") != 0) ? receiver : transmitter; // Compare the role string
+    connectionParameters.role = (strcmp(baseRole, "tx") != 0) ? receiver : transmitter; // Compare the role string
     connectionParameters.baudRate = baudRate;
     connectionParameters.nRetransmissions = nTries;
     connectionParameters.timeout = timeout;
@@ -36,74 +931,155 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         case transmitter: {
             // Sender role
 
-            // Open the file for reading
-            FILE *file = fopen(filename, "rb");
+            // Open the file for reading ("-" streams standard input, whose size is unknown)
+            int streaming = (strcmp(filename, "-") == 0);
+            FILE *file = streaming ? stdin : fopen(filename, "rb");
             if (file == NULL) {
                 perror("File not found\n");
                 exit(-1);
             }
 
             // Calculate the file size
-            int initial = ftell(file);
-            fseek(file, 0L, SEEK_END);
-            long int f_size = ftell(file) - initial;
-            fseek(file, initial, SEEK_SET);
+            long int f_size = -1;
+            if (!streaming) {
+                int initial = ftell(file);
+                fseek(file, 0L, SEEK_END);
+                f_size = ftell(file) - initial;
+                fseek(file, initial, SEEK_SET);
+            }
 
 
             // Create and send the start packet to signal the beginning of transmission
             unsigned int controlPacketSize;
             unsigned char *startPacket = createControlPacket(2, filename, f_size, &controlPacketSize);
+            unsigned char options = hasRoleOption(role, "delta") ? OPTION_DELTA : 0;
+            if (hasRoleOption(role, "cache")) options |= OPTION_CACHE;
+
+            // Delta and chunk cache modes map the whole file, which a stream cannot offer
+            if (streaming && options != 0) {
+                printf("Streaming from standard input, delta and cache options ignored\n");
+                options = 0;
+            }
+            if (options != 0) startPacket = appendControlTLV(startPacket, &controlPacketSize, TLV_OPTIONS, 1, &options);
             if (llwrite(startPacket, controlPacketSize) == -1) {
                 printf("An error occurred in the start Packet\n");
                 exit(-1);
             }
+            free(startPacket);
 
             // Send data packets until there are no more data bytes left to send
+            // Each chunk is read into a pooled buffer, so memory use does not grow with the file
+            // The payload size follows the frame error rate observed on the link
             unsigned char i = 0;
-            unsigned char *stuff = (unsigned char *)malloc(sizeof(unsigned char) * f_size);
-            fread(stuff, sizeof(unsigned char), f_size, file);
+            unsigned char *chunk = llgetPacket();
             long int bytesLeftToSend = f_size;
+            long int bytesSent = 0;
+            PayloadSizer sizer;
+            payloadSizerInit(&sizer);
 
-            while (bytesLeftToSend > 0) {
-                int size_of_data = (bytesLeftToSend > MAX_PAYLOAD_SIZE) ? MAX_PAYLOAD_SIZE : bytesLeftToSend;
-                unsigned char *data = (unsigned char *)malloc(size_of_data);
-                memcpy(data, stuff, size_of_data);
-                int packetSize = 4 + size_of_data;
-                /* unsigned char *packet = D_Packet(i, data, size_of_data, &packetSize); */
+            // The file is hashed as it is read, for the receiver to verify the transfer
+            FileHash fileHash;
+            fileHashInit(&fileHash, 0);
+
+            // Chunks of zero bytes are held back and sent as a single hole packet
+            long int holeLength = 0;
+
+            // Progress reports travel on their own channel, ahead of the data packets
+            ChannelMux mux;
+            if (channelMuxInit(&mux) < 0) {
+                printf("An error occurred creating the channels\n");
+                exit(-1);
+            }
+            channelOpen(&mux, CHANNEL_STATUS, STATUS_PRIORITY, MAX_CHANNEL_MESSAGE, NULL, NULL);
+            time_t lastStatus = time(NULL);
+
+            // In delta mode only what the receiver's old copy lacks is sent, and in chunk cache
+            // mode (which takes precedence) only the chunks missing from the receiver's store
+            if (options & OPTION_CACHE) {
+                if (sendFileChunked(file, f_size, &i, &sizer, &fileHash)) bytesLeftToSend = 0;
+            }
+            else if ((options & OPTION_DELTA) && sendFileDelta(file, f_size, &i, &sizer, &fileHash)) bytesLeftToSend = 0;
+
+            // A stream is sent until end of file, its length is only known at the end
+            while (streaming || bytesLeftToSend > 0) {
+                int size_of_data = (streaming || bytesLeftToSend > sizer.size) ? sizer.size : bytesLeftToSend;
+                size_t bytesRead = fread(chunk, sizeof(unsigned char), size_of_data, file);
+                if (streaming && bytesRead == 0 && !ferror(file)) break;
+                if (bytesRead == 0 || (!streaming && bytesRead != size_of_data)) {
+                    printf("An error occurred reading the file\n");
+                    exit(-1);
+                }
+                size_of_data = bytesRead;
+                bytesSent += size_of_data;
+                fileHashUpdate(&fileHash, chunk, size_of_data);
+                if (isZeroRun(chunk, size_of_data)) {
+                    holeLength += size_of_data;
+                    bytesLeftToSend -= size_of_data;
+                    continue;
+                }
+                if (holeLength > 0) {
+                    sendHole(bytesSent - size_of_data - holeLength, holeLength, &i);
+                    holeLength = 0;
+                }
 
-                unsigned char *packet = (unsigned char *)malloc(packetSize);
+                // Queue a progress report now and then, and send whatever is more urgent than the data
+                if (time(NULL) - lastStatus >= STATUS_INTERVAL) {
+                    char status[MAX_CHANNEL_MESSAGE];
+                    int statusLength = streaming ? snprintf(status, sizeof(status), "%ld bytes sent", bytesSent)
+                                                 : snprintf(status, sizeof(status), "%ld of %ld bytes sent", bytesSent, f_size);
+                    channelSend(&mux, CHANNEL_STATUS, (unsigned char *) status, statusLength);
+                    lastStatus = time(NULL);
+                }
+                if (channelFlush(&mux, STATUS_PRIORITY) < 0) {
+                    printf("An error occurred in a channel Packet\n");
+                    exit(-1);
+                }
+                int packetSize = 4 + size_of_data;
+                unsigned char header[4];
 
                 // Populate the data packet fields
-                packet[0] = 1; // Data packet type
-                packet[1] = i; // Packet sequence number
-                packet[2] = size_of_data >> 8 & 0xFF; // High byte of size_of_data
-                packet[3] = size_of_data & 0xFF; // Low byte of size_of_data
+                header[0] = 1; // Data packet type
+                header[1] = i; // Packet sequence number
+                header[2] = size_of_data >> 8 & 0xFF; // High byte of size_of_data
+                header[3] = size_of_data & 0xFF; // Low byte of size_of_data
 
-                // Copy the data into the data packet
-                memcpy(packet + 4, data, size_of_data);
+                // The header and the file chunk are sent as separate segments, without staging copies
+                struct iovec packet[2] = {{header, 4}, {chunk, size_of_data}};
 
-                if (llwrite(packet, packetSize) == -1) {
+                if (llwritev(packet, 2) == -1) {
                     printf("An error occurred in the data Packet\n");
                     exit(-1);
                 }
 
-                bytesLeftToSend -= MAX_PAYLOAD_SIZE;
-                if (bytesLeftToSend <= 0) {
+                payloadSizerUpdate(&sizer);
+                bytesLeftToSend -= size_of_data;
+                if (streaming) {
+                    printf("Sent Packet with %d bytes --- %ld sent so far! \n", packetSize, bytesSent);
+                } else if (bytesLeftToSend <= 0) {
                     printf("Sent Packet with %d bytes --- 0 left to be sent! \n", packetSize);
                 } else {
                     printf("Sent Packet with %d bytes --- %ld left to be sent! \n", packetSize, bytesLeftToSend);
                 }
                 printf("-----------------------\n");
-                stuff += size_of_data;
                 i = (i + 1) % 255;
             }
+            if (holeLength > 0) sendHole(bytesSent - holeLength, holeLength, &i);
+            channelMuxDestroy(&mux);
+            llputPacket(chunk);
+            if (!streaming) fclose(file);
 
-            // Send the final packet to signal the end of transmission
-            unsigned char *endPacket = createControlPacket(3, filename, f_size, &controlPacketSize);
-            while (llwrite(endPacket, controlPacketSize) == -1) {
+            // Send the final packet to signal the end of transmission, with the final length
+            unsigned char *endPacket = createControlPacket(3, filename, streaming ? bytesSent : f_size, &controlPacketSize);
+            unsigned long long digest = fileHashDigest(&fileHash);
+            unsigned char digestBytes[8];
+            for (int b = 0; b < 8; b++)
+                digestBytes[b] = digest >> (56 - 8 * b) & 0xFF;
+            endPacket = appendControlTLV(endPacket, &controlPacketSize, TLV_HASH, 8, digestBytes);
+            if (llwrite(endPacket, controlPacketSize) == -1) {
                 printf("An error occurred in the end Packet\n");
-                
+                exit(-1);
             }
+            free(endPacket);
 
 
             // Close the connection
@@ -114,48 +1090,166 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         case receiver: {
             // Receiver role
 
-            unsigned char *packet = (unsigned char *)malloc(MAX_PAYLOAD_SIZE);
+            unsigned char *packet = llgetPacket();
             int packetSize = -1;
 
             // Wait for the start packet to initiate the reception
-            while ((packetSize = llread(packet)) < 0);
+            packetSize = readPacket(packet);
+
+            // Extract the new file size from the start packet (-1 for a stream of unknown size)
+            long int rcvFileSize = controlPacketLength(packet, packetSize);
 
-            // Extract the new file size from the start packet
-            unsigned char fSizeB = packet[2];
-            unsigned char fSizeAux[fSizeB];
-            memcpy(fSizeAux, packet + 3, fSizeB);
+            // "-" streams to standard output: the console messages move to standard error,
+            // including those still buffered, so only file data reaches the stream
+            int streaming = (strcmp(filename, "-") == 0);
+            int streamFd = -1;
+            if (streaming) {
+                streamFd = dup(STDOUT_FILENO);
+                dup2(STDERR_FILENO, STDOUT_FILENO);
+            }
 
-            // Reconstruct the file size
-            unsigned long int rcvFileSize = 0;
-            for (unsigned int i = 0; i < fSizeB; i++)
-                rcvFileSize |= (fSizeAux[fSizeB - i - 1] << (8 * i));
+            // In delta mode, the old copy is signed and then used as the basis of the new one,
+            // which is built next to it and renamed over it at the end
+            unsigned char optionsLength;
+            const unsigned char *options = findControlTLV(packet, packetSize, TLV_OPTIONS, &optionsLength);
+            FILE *basis = NULL;
+            int blockSize = 0;
+            char partFilename[300];
+            snprintf(partFilename, sizeof(partFilename), "%s.part", filename);
+            // A stream has no old copy: the empty signature set makes the sender send it all
+            if (options != NULL && optionsLength > 0 && (options[0] & OPTION_DELTA) &&
+                !(options[0] & OPTION_CACHE)) {
+                basis = streaming ? NULL : fopen(filename, "rb");
+                blockSize = sendSignatures(basis);
+                if (blockSize == 0 && basis != NULL) {
+                    fclose(basis);
+                    basis = NULL;
+                }
+            }
 
             // Open a new file for writing
-            FILE *newFile = fopen((char *)filename, "wb+");
+            FILE *newFile = streaming ? fdopen(streamFd, "wb") : fopen((basis != NULL) ? partFilename : filename, "wb+");
+            if (newFile == NULL) {
+                perror(filename);
+                exit(-1);
+            }
+            OutputFile output = {newFile, 0};
+            fileHashInit(&output.hash, 0);
+
+            // In chunk cache mode the file is rebuilt from the store and the missing chunks
+            ChunkReceiver chunks;
+            int cached = (options != NULL && optionsLength > 0 && (options[0] & OPTION_CACHE));
+            if (cached) chunkReceiverStart(&chunks, &output, packet);
+
+            // Messages of the other channels are handed to their handlers
+            ChannelMux mux;
+            if (channelMuxInit(&mux) < 0) {
+                printf("An error occurred creating the channels\n");
+                exit(-1);
+            }
+            channelOpen(&mux, CHANNEL_STATUS, STATUS_PRIORITY, MAX_CHANNEL_MESSAGE, printStatus, NULL);
 
             // Receive and write data packets until the end packet is received
+            // The header and the body are scattered apart, so the body can be written as is
+            unsigned char header[4];
+            struct iovec segments[2] = {{header, 4}, {packet, PACKET_BODY_SIZE}};
+            long int endFileSize = -1;
+            const unsigned char *endHash = NULL;
+            unsigned char endHashLength = 0;
             while (1) {
 
                 // Wait for the next packet
-                while ((packetSize = llread(packet)) < 0);
+                if ((packetSize = llreadv(segments, 2)) < 0) {
+                    printf("An error occurred on the link\n");
+                    exit(-1);
+                }
 
                 // Break if the end packet is received
                 if (packetSize == 0) break;
 
                 // Check if the packet is a data packet (not an end packet)
-                else if (packet[0] != 3) {
-                    unsigned char *buffer = (unsigned char *)malloc(packetSize - 4);
-                    memcpy(buffer, packet + 4, packetSize - 4);
-                    fwrite(buffer, sizeof(unsigned char), packetSize - 4, newFile);
-                    free(buffer);
+                else if (header[0] == 1) {
+                    if (cached) chunkReceiverData(&chunks, packet, packetSize - 4);
+                    else writeOutput(&output, packet, packetSize - 4);
+                }
+
+                // Copy the referenced blocks of the old file
+                else if (header[0] == PACKET_COPY && basis != NULL && packetSize >= 8) {
+                    long int first = (long int) (packet[0] << 24 | packet[1] << 16 | packet[2] << 8 | packet[3]);
+                    long int left = (long int) (header[2] << 8 | header[3]) * blockSize;
+                    fseek(basis, first * blockSize, SEEK_SET);
+                    while (left > 0) {
+                        int n = (left > PACKET_BODY_SIZE) ? PACKET_BODY_SIZE : left;
+                        if (fread(packet, sizeof(unsigned char), n, basis) != n) break;
+                        writeOutput(&output, packet, n);
+                        left -= n;
+                    }
                 }
 
-                // Continue if the packet is an end packet
+                // Skip over a run of zero bytes
+                else if (header[0] == PACKET_HOLE && !cached && packetSize >= 20) {
+                    long int offset = 0, length = 0;
+                    for (int b = 0; b < 8; b++) {
+                        offset = offset << 8 | packet[b];
+                        length = length << 8 | packet[8 + b];
+                    }
+                    if (offset != output.written)
+                        printf("Hole at %ld, but %ld bytes were written\n", offset, output.written);
+                    writeHole(&output, length);
+                }
+
+                // Deliver a channel message, joining its header back to the body
+                else if (header[0] == PACKET_CHANNEL) {
+                    memmove(packet + 4, packet, packetSize - 4);
+                    memcpy(packet, header, 4);
+                    channelDispatch(&mux, packet, packetSize);
+                }
+
+                // Keep the length carried by the end packet, joining its header back to the body
+                else if (header[0] == 3) {
+                    memmove(packet + 4, packet, packetSize - 4);
+                    memcpy(packet, header, 4);
+                    endFileSize = controlPacketLength(packet, packetSize);
+                    endHash = findControlTLV(packet, packetSize, TLV_HASH, &endHashLength);
+                }
+
+                // Continue on any other packet
                 else continue;
             }
 
-            // Close the new file
+            // Check the length announced by the end packet (the only one, for a stream)
+            int intact = TRUE;
+            if (rcvFileSize < 0) rcvFileSize = endFileSize;
+            if (rcvFileSize >= 0 && rcvFileSize != output.written) {
+                printf("Received %ld bytes, but %ld were announced\n", output.written, rcvFileSize);
+                intact = FALSE;
+            }
+
+            // Compare the hash computed while writing with the one computed while reading
+            if (endHash != NULL && endHashLength == 8) {
+                unsigned long long expected = 0;
+                for (int b = 0; b < 8; b++)
+                    expected = expected << 8 | endHash[b];
+                unsigned long long actual = fileHashDigest(&output.hash);
+                if (actual == expected) printf("File hash matches (xxh64 %016llx)\n", actual);
+                else {
+                    printf("File hash MISMATCH: received %016llx, sent %016llx\n", actual, expected);
+                    intact = FALSE;
+                }
+            }
+
+            // Close the new file, whose length must also cover a trailing hole
+            if (cached) chunkReceiverFinish(&chunks);
+            finishOutput(&output);
             fclose(newFile);
+            // The old copy is only replaced by a new one that checks out, as it is the only good basis
+            if (basis != NULL) {
+                fclose(basis);
+                if (intact) rename(partFilename, filename);
+                else printf("Transfer failed: %s kept, the new copy is left in %s\n", filename, partFilename);
+            }
+            channelMuxDestroy(&mux);
+            llputPacket(packet);
             break;
         }
 
@@ -170,14 +1264,16 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
 unsigned char *createControlPacket(const unsigned int ctrlField, const char *filename, long int length, unsigned int *size) {
 
     int len1 = 0;
-    unsigned int tmp = length;
+    unsigned long int tmp = length;
 
     // Calculate the number of bytes required to represent the file size
-    while (tmp > 1) {
-        tmp >>= 1;
-        len1++;
+    // (at least one, an unknown size is sent with no bytes at all)
+    if (length >= 0) {
+        do {
+            tmp >>= 8;
+            len1++;
+        } while (tmp > 0);
     }
-    len1 = (len1 + 7) / 8; // File size in bytes
 
     // Calculate the length of the file name
     const int len2 = strlen(filename);
@@ -208,4 +1304,39 @@ unsigned char *createControlPacket(const unsigned int ctrlField, const char *fil
     return packet;
 }
 
+// Helper function to read the file size of a control packet
+long int controlPacketLength(const unsigned char *packet, unsigned int size) {
+    unsigned char length;
+    const unsigned char *value = findControlTLV(packet, size, 0, &length);
+    if (value == NULL || length == 0 || length > sizeof(long int)) return -1;
+
+    long int fileSize = 0;
+    for (unsigned int i = 0; i < length; i++)
+        fileSize = fileSize << 8 | value[i];
+    return fileSize;
+}
+
+// Helper function to append a TLV to a control packet
+unsigned char *appendControlTLV(unsigned char *packet, unsigned int *size, unsigned char type,
+                                unsigned char length, const unsigned char *value) {
+    packet = (unsigned char *)realloc(packet, *size + 2 + length);
+    packet[(*size)++] = type;
+    packet[(*size)++] = length;
+    memcpy(packet + *size, value, length);
+    *size += length;
+    return packet;
+}
 
+// Helper function to find a TLV in a control packet
+const unsigned char *findControlTLV(const unsigned char *packet, unsigned int size, unsigned char type,
+                                    unsigned char *length) {
+    unsigned int pos = 1;
+    while (pos + 2 <= size && pos + 2 + packet[pos + 1] <= size) {
+        if (packet[pos] == type) {
+            *length = packet[pos + 1];
+            return packet + pos + 2;
+        }
+        pos += 2 + packet[pos + 1];
+    }
+    return NULL;
+}
@@ -0,0 +1,125 @@
+// Logical channel multiplexer implementation
+
+#include "channel.h"
+#include "link_layer.h"
+
+// Function to initialise a multiplexer with every channel closed.
+// Queued messages come from a pool, so sending never touches the heap.
+// Returns 1 on success or -1 on error.
+int channelMuxInit(ChannelMux *mux) {
+    memset(mux, 0, sizeof(ChannelMux));
+    return poolInit(&mux->messages, sizeof(ChannelMessage), CHANNEL_QUEUE_SIZE);
+}
+
+// Function to open a channel.
+// Returns 1 on success or -1 on error.
+int channelOpen(ChannelMux *mux, unsigned char channel, unsigned char priority, int quantum,
+                ChannelHandler handler, void *context) {
+    if (channel == CHANNEL_BULK || channel >= MAX_CHANNELS || quantum <= 0) return -1;
+
+    Channel *c = &mux->channels[channel];
+    c->open = TRUE;
+    c->priority = priority;
+    c->quantum = quantum;
+    c->deficit = 0;
+    c->handler = handler;
+    c->context = context;
+    return 1;
+}
+
+// Function to queue a message on a channel.
+// Returns 1 on success or -1 on error.
+int channelSend(ChannelMux *mux, unsigned char channel, const unsigned char *data, int length) {
+    if (channel >= MAX_CHANNELS || !mux->channels[channel].open) return -1;
+    if (length <= 0 || length > MAX_CHANNEL_MESSAGE) return -1;
+
+    ChannelMessage *message = (ChannelMessage *) poolGet(&mux->messages);
+    if (message == NULL) return -1;
+    message->next = NULL;
+    message->length = length;
+    memcpy(message->data, data, length);
+
+    Channel *c = &mux->channels[channel];
+    if (c->tail != NULL) c->tail->next = message;
+    else c->head = message;
+    c->tail = message;
+    return 1;
+}
+
+// Function to pick the channel of the next message: the highest priority with messages
+// queued, and among those, deficit round robin over the message lengths.
+// Returns the channel or -1 if no channel of at least "priority" has messages queued.
+int channelNext(ChannelMux *mux, unsigned char priority) {
+    int best = -1;
+    for (int k = 0; k < MAX_CHANNELS; k++) {
+        Channel *c = &mux->channels[k];
+        if (c->head != NULL && c->priority >= priority && (best < 0 || c->priority > best)) best = c->priority;
+    }
+    if (best < 0) return -1;
+
+    // Every pass over the channels credits each one its quantum, so this ends
+    while (1) {
+        for (int n = 0; n < MAX_CHANNELS; n++) {
+            int k = (mux->next + n) % MAX_CHANNELS;
+            Channel *c = &mux->channels[k];
+            if (c->head == NULL || c->priority != best) continue;
+            if (c->deficit >= c->head->length) {
+                mux->next = k;
+                return k;
+            }
+            c->deficit += c->quantum;
+        }
+    }
+}
+
+// Function to send every queued message with a priority of at least "priority".
+// Returns the number of messages sent or -1 on error.
+int channelFlush(ChannelMux *mux, unsigned char priority) {
+    int sent = 0;
+    int k;
+
+    while ((k = channelNext(mux, priority)) >= 0) {
+        Channel *c = &mux->channels[k];
+        ChannelMessage *message = c->head;
+
+        unsigned char header[CHANNEL_HEADER_SIZE] = {PACKET_CHANNEL, mux->sequence, k,
+                                                     message->length >> 8 & 0xFF, message->length & 0xFF};
+        struct iovec packet[2] = {{header, CHANNEL_HEADER_SIZE}, {message->data, message->length}};
+        if (llwritev(packet, 2) == -1) return -1;
+        mux->sequence = (mux->sequence + 1) % 255;
+
+        // A channel that runs out of messages starts its next round without credit
+        c->deficit -= message->length;
+        c->head = message->next;
+        if (c->head == NULL) {
+            c->tail = NULL;
+            c->deficit = 0;
+            mux->next = (k + 1) % MAX_CHANNELS;
+        }
+        poolPut(&mux->messages, (unsigned char *) message);
+        sent++;
+    }
+    return sent;
+}
+
+// Function to hand a received channel packet to the handler of its channel.
+// Returns 1 if it was delivered or -1 if it is malformed or its channel is closed.
+int channelDispatch(ChannelMux *mux, const unsigned char *packet, int size) {
+    if (size < CHANNEL_HEADER_SIZE || packet[0] != PACKET_CHANNEL) return -1;
+
+    unsigned char channel = packet[2];
+    int length = packet[3] << 8 | packet[4];
+    if (channel >= MAX_CHANNELS || length > size - CHANNEL_HEADER_SIZE) return -1;
+
+    Channel *c = &mux->channels[channel];
+    if (!c->open || c->handler == NULL) return -1;
+    c->handler(channel, packet + CHANNEL_HEADER_SIZE, length, c->context);
+    return 1;
+}
+
+// Function to discard the queued messages of every channel and release the queue.
+void channelMuxDestroy(ChannelMux *mux) {
+    for (int k = 0; k < MAX_CHANNELS; k++)
+        mux->channels[k].head = mux->channels[k].tail = NULL;
+    poolDestroy(&mux->messages);
+}
@@ -0,0 +1,202 @@
+// Content-addressed chunk store implementation
+
+#include "chunk_store.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK_INDEX_MAGIC 0x4B4E4843 // "CHNK"
+
+// Gear hash table, filled on first use
+unsigned long long gearTable[256];
+int gearReady = 0;
+
+// Function to fill the gear table with fixed pseudo-random values (splitmix64), so both
+// ends cut the same boundaries.
+void gearInit() {
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 256; i++) {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gearTable[i] = z ^ (z >> 31);
+    }
+    gearReady = 1;
+}
+
+// Function to find the end of the content-defined chunk starting at "data".
+// Returns the chunk length (at most "length").
+size_t chunkBoundary(const unsigned char *data, size_t length) {
+    const unsigned long long mask = ((1ULL << CHUNK_AVERAGE_BITS) - 1) << (64 - CHUNK_AVERAGE_BITS);
+    unsigned long long hash = 0;
+
+    if (!gearReady) gearInit();
+    if (length <= CHUNK_MIN_SIZE) return length;
+    if (length > CHUNK_MAX_SIZE) length = CHUNK_MAX_SIZE;
+
+    // Bytes below the minimum size never end a chunk, so they are skipped
+    for (size_t i = CHUNK_MIN_SIZE; i < length; i++) {
+        hash = (hash << 1) + gearTable[data[i]];
+        if ((hash & mask) == 0) return i + 1;
+    }
+    return length;
+}
+
+// Function to map the index file with "capacity" slots.
+// Returns 1 on success or -1 on error.
+int chunkIndexMap(ChunkStore *store, unsigned int capacity) {
+    size_t size = sizeof(ChunkIndexHeader) + (size_t) capacity * sizeof(ChunkEntry);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->indexFd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    store->header = (ChunkIndexHeader *) map;
+    store->entries = (ChunkEntry *) (store->header + 1);
+    return 1;
+}
+
+// Function to unmap the index file.
+void chunkIndexUnmap(ChunkStore *store) {
+    if (store->header == NULL) return;
+    munmap(store->header, sizeof(ChunkIndexHeader) + (size_t) store->header->capacity * sizeof(ChunkEntry));
+    store->header = NULL;
+    store->entries = NULL;
+}
+
+// Function to find the slot of "hash", or the empty slot where it belongs.
+ChunkEntry *chunkIndexSlot(const ChunkStore *store, unsigned long long hash) {
+    unsigned int mask = store->header->capacity - 1;
+    unsigned int slot = (unsigned int) (hash ^ (hash >> 32)) & mask;
+
+    while (store->entries[slot].hash != 0 && store->entries[slot].hash != hash)
+        slot = (slot + 1) & mask;
+    return &store->entries[slot];
+}
+
+// Function to double the capacity of the index, keeping it below 70% full.
+// Returns 1 on success or -1 on error.
+int chunkIndexGrow(ChunkStore *store) {
+    unsigned int capacity = store->header->capacity;
+    unsigned int count = store->header->count;
+
+    ChunkEntry *old = (ChunkEntry *) malloc((size_t) capacity * sizeof(ChunkEntry));
+    if (old == NULL) return -1;
+    memcpy(old, store->entries, (size_t) capacity * sizeof(ChunkEntry));
+    chunkIndexUnmap(store);
+
+    size_t size = sizeof(ChunkIndexHeader) + (size_t) capacity * 2 * sizeof(ChunkEntry);
+    if (ftruncate(store->indexFd, size) < 0 || chunkIndexMap(store, capacity * 2) < 0) {
+        free(old);
+        return -1;
+    }
+
+    memset(store->entries, 0, (size_t) capacity * 2 * sizeof(ChunkEntry));
+    store->header->capacity = capacity * 2;
+    store->header->count = count;
+    for (unsigned int i = 0; i < capacity; i++) {
+        if (old[i].hash != 0) *chunkIndexSlot(store, old[i].hash) = old[i];
+    }
+
+    free(old);
+    return 1;
+}
+
+// Function to open (or create) the store at "path".
+// Returns 1 on success or -1 on error.
+int chunkStoreOpen(ChunkStore *store, const char *path) {
+    char dataPath[256];
+    snprintf(dataPath, sizeof(dataPath), "%s.data", path);
+    snprintf(store->indexPath, sizeof(store->indexPath), "%s.index", path);
+    store->header = NULL;
+    store->entries = NULL;
+
+    store->dataFd = open(dataPath, O_RDWR | O_CREAT, 0644);
+    store->indexFd = open(store->indexPath, O_RDWR | O_CREAT, 0644);
+    if (store->dataFd < 0 || store->indexFd < 0) {
+        chunkStoreClose(store);
+        return -1;
+    }
+
+    struct stat st;
+    fstat(store->dataFd, &st);
+    store->dataSize = st.st_size;
+
+    // A new (or unrecognised) index starts empty
+    ChunkIndexHeader header;
+    if (pread(store->indexFd, &header, sizeof(header), 0) != sizeof(header) || header.magic != CHUNK_INDEX_MAGIC) {
+        header.magic = CHUNK_INDEX_MAGIC;
+        header.capacity = CHUNK_INDEX_INITIAL_CAPACITY;
+        header.count = 0;
+        header.reserved = 0;
+        size_t size = sizeof(header) + (size_t) header.capacity * sizeof(ChunkEntry);
+        if (ftruncate(store->indexFd, 0) < 0 || ftruncate(store->indexFd, size) < 0 ||
+            pwrite(store->indexFd, &header, sizeof(header), 0) != sizeof(header)) {
+            chunkStoreClose(store);
+            return -1;
+        }
+    }
+
+    if (chunkIndexMap(store, header.capacity) < 0) {
+        chunkStoreClose(store);
+        return -1;
+    }
+    return 1;
+}
+
+// Function to look up a chunk by hash.
+// Returns 1 if found (setting "offset" and "length") or 0 otherwise.
+int chunkStoreFind(const ChunkStore *store, unsigned long long hash, unsigned long long *offset,
+                   unsigned int *length) {
+    if (hash == 0) hash = 1;
+    ChunkEntry *entry = chunkIndexSlot(store, hash);
+    if (entry->hash == 0) return 0;
+
+    *offset = entry->location >> 24;
+    *length = entry->location & 0xFFFFFF;
+    return 1;
+}
+
+// Function to append bytes of a new chunk to the data file.
+// Returns 1 on success or -1 on error.
+int chunkStoreAppend(ChunkStore *store, const unsigned char *data, size_t length) {
+    if (pwrite(store->dataFd, data, length, store->dataSize) != (ssize_t) length) return -1;
+    store->dataSize += length;
+    return 1;
+}
+
+// Function to index the last "length" appended bytes as the chunk "hash".
+// Returns 1 on success or -1 on error.
+int chunkStoreCommit(ChunkStore *store, unsigned long long hash, unsigned int length) {
+    if (hash == 0) hash = 1;
+    if (store->header->count + 1 > store->header->capacity / 10 * 7 && chunkIndexGrow(store) < 0) return -1;
+
+    ChunkEntry *entry = chunkIndexSlot(store, hash);
+    if (entry->hash == 0) store->header->count++;
+    entry->hash = hash;
+    entry->location = (store->dataSize - length) << 24 | length;
+    return 1;
+}
+
+// Function to drop the bytes appended since the last commit.
+void chunkStoreRollback(ChunkStore *store, unsigned int length) {
+    store->dataSize -= length;
+    if (ftruncate(store->dataFd, store->dataSize) < 0) perror("ftruncate");
+}
+
+// Function to read "length" bytes of the data file from "offset".
+// Returns 1 on success or -1 on error.
+int chunkStoreRead(const ChunkStore *store, unsigned long long offset, unsigned char *buf, size_t length) {
+    return (pread(store->dataFd, buf, length, offset) == (ssize_t) length) ? 1 : -1;
+}
+
+// Function to close the store.
+void chunkStoreClose(ChunkStore *store) {
+    chunkIndexUnmap(store);
+    if (store->dataFd >= 0) close(store->dataFd);
+    if (store->indexFd >= 0) close(store->indexFd);
+    store->dataFd = -1;
+    store->indexFd = -1;
+}
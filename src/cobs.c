@@ -0,0 +1,72 @@
+// Consistent overhead byte stuffing (COBS) implementation
+
+#include "cobs.h"
+
+// Function to start encoding into "output".
+void cobsEncoderInit(CobsEncoder *encoder, unsigned char *output, unsigned char mask) {
+    encoder->code = output;
+    encoder->output = output + 1;
+    encoder->distance = 1;
+    encoder->mask = mask;
+}
+
+// Function to encode "length" more bytes.
+void cobsEncode(CobsEncoder *encoder, const unsigned char *data, size_t length) {
+    unsigned char *output = encoder->output;
+    unsigned char *code = encoder->code;
+    unsigned char distance = encoder->distance;
+    unsigned char mask = encoder->mask;
+
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) {
+            *output++ = data[i] ^ mask;
+            distance++;
+            if (distance != 0xFF) continue;
+        }
+        // A zero (or a full block of 254 bytes) closes the block
+        *code = distance ^ mask;
+        code = output++;
+        distance = 1;
+    }
+
+    encoder->output = output;
+    encoder->code = code;
+    encoder->distance = distance;
+}
+
+// Function to close the last block.
+// Returns the end of the encoded data.
+unsigned char *cobsEncoderFinish(CobsEncoder *encoder) {
+    *encoder->code = encoder->distance ^ encoder->mask;
+    return encoder->output;
+}
+
+// Function to start decoding a new frame.
+void cobsDecoderInit(CobsDecoder *decoder, unsigned char mask) {
+    decoder->left = 0;
+    decoder->zero = 0;
+    decoder->mask = mask;
+}
+
+// Function to decode one input byte.
+// Returns the decoded byte, or -1 if the input byte was a code byte with nothing to emit.
+int cobsDecode(CobsDecoder *decoder, unsigned char byte) {
+    byte ^= decoder->mask;
+
+    if (decoder->left > 0) {
+        decoder->left--;
+        return byte;
+    }
+
+    // Code byte: the zero closing the previous block is only emitted once another block follows
+    int result = decoder->zero ? 0 : -1;
+    decoder->left = byte - 1;
+    decoder->zero = (byte != 0xFF);
+    return result;
+}
+
+// Function to check that the input ended on a block boundary.
+// Returns 1 if the frame was well formed.
+int cobsDecoderComplete(const CobsDecoder *decoder) {
+    return decoder->left == 0;
+}
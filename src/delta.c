@@ -0,0 +1,123 @@
+// Delta transfer implementation: rolling checksums and block signature matching
+
+#include "delta.h"
+#include <stdlib.h>
+
+// Function to choose the block size for a basis file of "fileSize" bytes.
+// The square root of the size balances the signature traffic against the literal data
+// resent around each changed byte.
+int deltaBlockSize(long int fileSize) {
+    int blockSize = DELTA_MIN_BLOCK_SIZE;
+    while (blockSize < DELTA_MAX_BLOCK_SIZE && (long int) blockSize * blockSize < fileSize)
+        blockSize <<= 1;
+    return blockSize;
+}
+
+// Function to compute the checksum of the window starting at "data".
+// Returns the weak checksum.
+unsigned int rollingInit(RollingChecksum *checksum, const unsigned char *data, int blockSize) {
+    checksum->a = 0;
+    checksum->b = 0;
+    checksum->blockSize = blockSize;
+
+    for (int i = 0; i < blockSize; i++) {
+        checksum->a += data[i];
+        checksum->b += (unsigned int) (blockSize - i) * data[i];
+    }
+    return (checksum->a & 0xFFFF) | (checksum->b << 16);
+}
+
+// Function to slide the window by one byte, dropping "out" and taking "in".
+// Returns the weak checksum.
+unsigned int rollingRoll(RollingChecksum *checksum, unsigned char out, unsigned char in) {
+    checksum->a += in - out;
+    checksum->b += checksum->a - (unsigned int) checksum->blockSize * out;
+    return (checksum->a & 0xFFFF) | (checksum->b << 16);
+}
+
+// Function to compute the strong checksum of a block (64-bit FNV-1a).
+unsigned long long strongChecksum(const unsigned char *data, size_t length) {
+    return strongChecksumUpdate(STRONG_CHECKSUM_INIT, data, length);
+}
+
+// Function to extend a strong checksum with "length" more bytes.
+unsigned long long strongChecksumUpdate(unsigned long long hash, const unsigned char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Function to create an empty index for "count" blocks of "blockSize" bytes.
+// Returns 1 on success or -1 on error.
+int signatureIndexInit(SignatureIndex *index, int blockSize, int count) {
+    unsigned int buckets = 1;
+    while (buckets < (unsigned int) count) buckets <<= 1;
+
+    index->blockSize = blockSize;
+    index->count = 0;
+    index->mask = buckets - 1;
+    index->weak = (unsigned int *) malloc(count * sizeof(unsigned int));
+    index->strong = (unsigned long long *) malloc(count * sizeof(unsigned long long));
+    index->next = (int *) malloc(count * sizeof(int));
+    index->heads = (int *) malloc(buckets * sizeof(int));
+    if ((count > 0 && (index->weak == NULL || index->strong == NULL || index->next == NULL)) ||
+        index->heads == NULL) {
+        signatureIndexDestroy(index);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < buckets; i++)
+        index->heads[i] = -1;
+    return 1;
+}
+
+// Function to add the signature of the next block to the index.
+void signatureIndexAdd(SignatureIndex *index, unsigned int weak, unsigned long long strong) {
+    int block = index->count++;
+    unsigned int bucket = (weak ^ (weak >> 16)) & index->mask;
+
+    index->weak[block] = weak;
+    index->strong[block] = strong;
+    index->next[block] = index->heads[bucket];
+    index->heads[bucket] = block;
+}
+
+// Function to find a block matching the window at "data", whose weak checksum is "weak".
+// Returns the block number or -1 if there is no match.
+int signatureIndexFind(const SignatureIndex *index, unsigned int weak, const unsigned char *data, int preferred) {
+    unsigned int bucket = (weak ^ (weak >> 16)) & index->mask;
+    unsigned long long strong = 0;
+    int strongReady = 0;
+
+    // The strong checksum is only computed once the weak checksum matches
+    if (preferred >= 0 && preferred < index->count && index->weak[preferred] == weak) {
+        strong = strongChecksum(data, index->blockSize);
+        strongReady = 1;
+        if (index->strong[preferred] == strong) return preferred;
+    }
+
+    for (int block = index->heads[bucket]; block != -1; block = index->next[block]) {
+        if (index->weak[block] != weak) continue;
+        if (!strongReady) {
+            strong = strongChecksum(data, index->blockSize);
+            strongReady = 1;
+        }
+        if (index->strong[block] == strong) return block;
+    }
+    return -1;
+}
+
+// Function to release the memory of the index.
+void signatureIndexDestroy(SignatureIndex *index) {
+    free(index->weak);
+    free(index->strong);
+    free(index->next);
+    free(index->heads);
+    index->weak = NULL;
+    index->strong = NULL;
+    index->next = NULL;
+    index->heads = NULL;
+    index->count = 0;
+}
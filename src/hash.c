@@ -0,0 +1,133 @@
+// Incremental file hash implementation (xxHash64)
+
+#include "hash.h"
+#include <string.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Function to rotate "value" left by "bits".
+unsigned long long hashRotate(unsigned long long value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Function to read 8 little-endian bytes.
+unsigned long long hashRead64(const unsigned char *p) {
+    unsigned long long value = 0;
+    for (int i = 7; i >= 0; i--)
+        value = value << 8 | p[i];
+    return value;
+}
+
+// Function to read 4 little-endian bytes.
+unsigned long long hashRead32(const unsigned char *p) {
+    return (unsigned long long) p[0] | (unsigned long long) p[1] << 8 |
+           (unsigned long long) p[2] << 16 | (unsigned long long) p[3] << 24;
+}
+
+// Function to mix 8 input bytes into a lane accumulator.
+unsigned long long hashRound(unsigned long long accumulator, unsigned long long input) {
+    accumulator += input * PRIME64_2;
+    accumulator = hashRotate(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+// Function to fold a lane accumulator into the final hash.
+unsigned long long hashMerge(unsigned long long hash, unsigned long long lane) {
+    hash ^= hashRound(0, lane);
+    return hash * PRIME64_1 + PRIME64_4;
+}
+
+// Function to mix a 32-byte stripe into the four lanes.
+void hashStripe(FileHash *hash, const unsigned char *p) {
+    for (int i = 0; i < 4; i++)
+        hash->v[i] = hashRound(hash->v[i], hashRead64(p + 8 * i));
+}
+
+// Function to start a hash with the given seed.
+void fileHashInit(FileHash *hash, unsigned long long seed) {
+    hash->totalLength = 0;
+    hash->v[0] = seed + PRIME64_1 + PRIME64_2;
+    hash->v[1] = seed + PRIME64_2;
+    hash->v[2] = seed;
+    hash->v[3] = seed - PRIME64_1;
+    hash->buffered = 0;
+    hash->seed = seed;
+}
+
+// Function to add "length" bytes to the hash.
+void fileHashUpdate(FileHash *hash, const void *data, size_t length) {
+    const unsigned char *p = (const unsigned char *) data;
+    hash->totalLength += length;
+
+    // Complete the stripe left over from the previous update
+    if (hash->buffered > 0) {
+        size_t take = 32 - hash->buffered;
+        if (take > length) take = length;
+        memcpy(hash->buffer + hash->buffered, p, take);
+        hash->buffered += take;
+        p += take;
+        length -= take;
+        if (hash->buffered < 32) return;
+        hashStripe(hash, hash->buffer);
+        hash->buffered = 0;
+    }
+
+    // Whole stripes are hashed in place
+    while (length >= 32) {
+        hashStripe(hash, p);
+        p += 32;
+        length -= 32;
+    }
+
+    memcpy(hash->buffer, p, length);
+    hash->buffered = length;
+}
+
+// Function to get the hash of every byte added so far.
+unsigned long long fileHashDigest(const FileHash *hash) {
+    unsigned long long h;
+
+    if (hash->totalLength >= 32) {
+        h = hashRotate(hash->v[0], 1) + hashRotate(hash->v[1], 7) +
+            hashRotate(hash->v[2], 12) + hashRotate(hash->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = hashMerge(h, hash->v[i]);
+    }
+    else h = hash->seed + PRIME64_5;
+
+    h += hash->totalLength;
+
+    // Remaining bytes, 8, then 4, then 1 at a time
+    const unsigned char *p = hash->buffer;
+    unsigned int left = hash->buffered;
+    while (left >= 8) {
+        h ^= hashRound(0, hashRead64(p));
+        h = hashRotate(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        left -= 8;
+    }
+    if (left >= 4) {
+        h ^= hashRead32(p) * PRIME64_1;
+        h = hashRotate(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        left -= 4;
+    }
+    while (left > 0) {
+        h ^= *p * PRIME64_5;
+        h = hashRotate(h, 11) * PRIME64_1;
+        p++;
+        left--;
+    }
+
+    // Final avalanche
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
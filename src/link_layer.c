@@ -4,73 +4,85 @@
 
 // Global variables to manage the state and parameters of the link layer.
 volatile int STOP = FALSE;            // Flag to control program execution
-int fd = 0;                            // File descriptor for the serial port
+Transport transport;                   // Serial port, socket or shared memory carrying the frames
 int alarmEnabled = FALSE;              // Flag to indicate if an alarm is active
 int alarmCount = 0;                    // Counter for the number of alarms triggered
 int timeout = 0;                       // Timeout value for communication
 int retransmissions = 0;               // Maximum number of retransmissions allowed
-unsigned char tramaTx = 0;             // Counter for transmitted frames
-unsigned char tramaRx = 1;             // Counter for received frames
+unsigned char tramaTx = 0;             // Ns of the next (or pending) transmitted frame
+unsigned char tramaRx = 0;             // Ns expected in the next received frame, sent back as Nr
+unsigned char ownAddress = A_TX;       // Address field of every frame this station sends
+unsigned char peerAddress = A_RX;      // Address field of every frame the peer sends
+LinkLayerRole role = transmitter;      // Role of this station
+int ackPending = FALSE;                // Flag to indicate a received I-frame still has to be acknowledged
+volatile sig_atomic_t ackHeld = FALSE; // Flag to indicate an acknowledgment waits for the next read
+LinkStatistics statistics;             // Transfer statistics since llopen
+LinkFraming requestedFraming = FRAMING_STUFFING; // Framing proposed by the transmitter
+LinkFraming framing = FRAMING_STUFFING; // Framing agreed by llopen
+int reconnecting = FALSE;              // Flag to indicate the link is down and being re-established
+int reconnectDelay = 0;                // Seconds until the next SET while reconnecting
+struct timespec reconnectDeadline;     // Instant of the next SET while reconnecting
+struct timespec reconnectGiveUp;       // Instant at which re-establishment is abandoned
+int linkFailed = FALSE;                // Flag to indicate the link could not be re-established
+struct timespec keepaliveDeadline;     // Instant of the next keepalive probe
+int probesUnanswered = 0;              // Keepalive probes sent since the peer was last heard
+int paceRate = 0;                      // Bytes per second the serial port drains
+long paceCredit = 0;                   // Microseconds of line time available to writes
+struct timespec paceStamp;             // Instant paceCredit was last refilled
 clock_t start_time;                     // Start time for measuring elapsed time
+Pool framePool;                        // Buffers for stuffed I-frames
+Pool packetPool;                       // Buffers for application packets
+
+// Function to set a deadline "seconds" from now.
+void llsetDeadline(struct timespec *deadline, int seconds) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += seconds;
+}
+
+void llholdPeer();
 
 // Function to handle the alarm signal.
 void alarmHandler(int signal) {
+    // The grace period of a held acknowledgment ran out, which is no retransmission alarm
+    if (ackHeld) {
+        llholdPeer();
+        return;
+    }
     alarmEnabled = TRUE;
     alarmCount++;
     printf("Alarm #%d\n", alarmCount);
 }
 
-// Function to establish a connection on the specified serial port.
-// Returns the file descriptor on success or -1 on error.
-int establishConnection(const char *serialPort) {
-
-    // Open the serial port
-    int fd = open(serialPort, O_RDWR | O_NOCTTY);
-    if (fd < 0) {
-        perror(serialPort);
-        return -1; 
-    }
-
-    // Configure the serial port settings
-    struct termios oldtio;
-    struct termios newtio;
-
-    if (tcgetattr(fd, &oldtio) == -1) {
-        perror("tcgetattr");
-        exit(-1);
-    }
-
-    memset(&newtio, 0, sizeof(newtio));
-
-    newtio.c_cflag = BAUDRATE | CS8 | CLOCAL | CREAD;
-    newtio.c_iflag = IGNPAR;
-    newtio.c_oflag = 0;
-    newtio.c_lflag = 0;
-    newtio.c_cc[VTIME] = 0;
-    newtio.c_cc[VMIN] = 0;
-
-    tcflush(fd, TCIOFLUSH);
-
-    if (tcsetattr(fd, TCSANOW, &newtio) == -1) {
-        perror("tcsetattr");
-        return -1;
-    }
-
-    return fd;
+// Function to choose the framing the transmitter proposes in llopen.
+void llsetFraming(LinkFraming proposed) {
+    requestedFraming = proposed;
 }
 
 // Function to establish a connection using the specified link layer parameters.
-// Returns the file descriptor on success or -1 on error.
+// Returns 1 on success or -1 on error.
 int llopen(LinkLayer connectionParameters) {
     
-    // Initialize link layer state and open the serial port
+    // Initialize link layer state and open the transport (the receiver listens)
     llState state = START;
-    fd = establishConnection(connectionParameters.serialPort);
-    if (fd < 0) return -1;
+    int baudRate = connectionParameters.baudRate;
+    if (transportOpen(&transport, connectionParameters.serialPort, &baudRate,
+                      connectionParameters.role == receiver) < 0) return -1;
+
+    // Allocate every frame and packet buffer up front, so transfers never touch the heap
+    if (poolInit(&framePool, MAX_FRAME_SIZE, FRAME_POOL_SIZE) < 0 ||
+        poolInit(&packetPool, MAX_PACKET_SIZE, PACKET_POOL_SIZE) < 0) {
+        transportClose(&transport);
+        return -1;
+    }
 
     unsigned char byte;
+    unsigned char ctrlField = 0;
     timeout = connectionParameters.timeout;
     retransmissions = connectionParameters.nRetransmissions;
+    role = connectionParameters.role;
+    memset(&statistics, 0, sizeof(statistics));
+    ownAddress = (role == transmitter) ? A_TX : A_RX;
+    peerAddress = (role == transmitter) ? A_RX : A_TX;
 
     // Switch based on the role (transmitter or receiver)
     switch (connectionParameters.role) {
@@ -85,12 +97,13 @@ int llopen(LinkLayer connectionParameters) {
             // Loop until either successful communication or maximum retransmissions reached
             while (retransmissions != 0 && state != STOP_RECEIVED) {
                 
-                 // Construct and send the SET frame
-                unsigned char setFrame[5] = {FLAG, A_TX, C_SET, A_TX ^ C_SET, FLAG};
+                 // Construct and send the SET frame, proposing the requested framing
+                unsigned char setCtrl = (requestedFraming == FRAMING_COBS) ? C_SET_COBS : C_SET;
+                unsigned char setFrame[5] = {FLAG, A_TX, setCtrl, A_TX ^ setCtrl, FLAG};
                 // Send the SET frame
-                if(write(fd, setFrame, 5) < 0){
+                if(transportWrite(&transport, setFrame, 5) < 0){
                     printf("Send Frame Error\n");
-                    close(fd);
+                    transportClose(&transport);
                     return -1;
                 }
                 
@@ -100,7 +113,7 @@ int llopen(LinkLayer connectionParameters) {
                 
                 // Inner loop for receiving frames and transitioning through states
                 while (alarmEnabled == FALSE && state != STOP_RECEIVED) {
-                    if (read(fd, &byte, 1) > 0) {
+                    if (transportRead(&transport, &byte, 1) > 0) {
                         switch (state) {
                             case START:
                                 if (byte == FLAG) state = FLAG_RECEIVED;
@@ -110,12 +123,15 @@ int llopen(LinkLayer connectionParameters) {
                                 else if (byte != FLAG) state = START;
                                 break;
                             case A_RECEIVED:
-                                if (byte == C_UA) state = C_RECEIVED;
+                                if (byte == C_UA || byte == C_UA_COBS) {
+                                    ctrlField = byte;
+                                    state = C_RECEIVED;
+                                }
                                 else if (byte == FLAG) state = FLAG_RECEIVED;
                                 else state = START;
                                 break;
                             case C_RECEIVED:
-                                if (byte == (A_RX ^ C_UA)) state = BCC_CHECK;
+                                if (byte == (A_RX ^ ctrlField)) state = BCC_CHECK;
                                 else if (byte == FLAG) state = FLAG_RECEIVED;
                                 else state = START;
                                 break;
@@ -134,16 +150,20 @@ int llopen(LinkLayer connectionParameters) {
             
             // Check if the connection was successfully established
             if (state != STOP_RECEIVED) {
-                close(fd);
+                transportClose(&transport);
                 return -1;
             }
+
+            // Cancel the pending SET alarm, timeouts are now tracked by llprocess
+            alarm(0);
+            framing = (ctrlField == C_UA_COBS) ? FRAMING_COBS : FRAMING_STUFFING;
             break;  
         }
 
         case receiver: {
             // Loop until a STOP frame is received
             while (state != STOP_RECEIVED) {
-                if (read(fd, &byte, 1) > 0) {
+                if (transportRead(&transport, &byte, 1) > 0) {
                     switch (state) {
                         case START:
                             if (byte == FLAG) state = FLAG_RECEIVED;
@@ -153,12 +173,15 @@ int llopen(LinkLayer connectionParameters) {
                             else if (byte != FLAG) state = START;
                             break;
                         case A_RECEIVED:
-                            if (byte == C_SET) state = C_RECEIVED;
+                            if (byte == C_SET || byte == C_SET_COBS) {
+                                ctrlField = byte;
+                                state = C_RECEIVED;
+                            }
                             else if (byte == FLAG) state = FLAG_RECEIVED;
                             else state = START;
                             break;
                         case C_RECEIVED:
-                            if (byte == (A_TX ^ C_SET)) state = BCC_CHECK;
+                            if (byte == (A_TX ^ ctrlField)) state = BCC_CHECK;
                             else if (byte == FLAG) state = FLAG_RECEIVED;
                             else state = START;
                             break;
@@ -172,130 +195,914 @@ int llopen(LinkLayer connectionParameters) {
                 }
             }  
 
-            // Construct and send the UA frame in response to SET frame reception
-            unsigned char uaFrame[5] = {FLAG, A_RX, C_UA, A_RX ^ C_UA, FLAG};
+            // Construct and send the UA frame in response to SET frame reception, confirming the framing
+            unsigned char uaCtrl = (ctrlField == C_SET_COBS) ? C_UA_COBS : C_UA;
+            unsigned char uaFrame[5] = {FLAG, A_RX, uaCtrl, A_RX ^ uaCtrl, FLAG};
             // Send UA frame in response to SET frame reception
-            if(write(fd, uaFrame, 5) < 0){
+            if(transportWrite(&transport, uaFrame, 5) < 0){
                 printf("Send Frame Error\n");
-                close(fd);
+                transportClose(&transport);
                 return -1;
             }
+            framing = (ctrlField == C_SET_COBS) ? FRAMING_COBS : FRAMING_STUFFING;
             break; 
         }
     }
-    // Return the file descriptor for the established connection
-    return fd;
+    if (framing == FRAMING_COBS) printf("Using COBS framing\n");
+
+    // Writes to a serial line are paced to it, starting with room for one frame
+    paceRate = transport.ops->paced ? baudRate / BITS_PER_BYTE : 0;
+    paceCredit = (paceRate > 0) ? (long) MAX_FRAME_SIZE * 1000000 / paceRate : 0;
+    clock_gettime(CLOCK_MONOTONIC, &paceStamp);
+
+    // The alarm also times the grace period of held acknowledgments, for either role
+    (void) signal(SIGALRM, alarmHandler);
+
+    // The peer was just heard from
+    reconnecting = FALSE;
+    linkFailed = FALSE;
+    probesUnanswered = 0;
+    llsetDeadline(&keepaliveDeadline, KEEPALIVE_INTERVAL);
+    return 1;
 }
 
 
 ////////////////////////////////////////////////
-// LLWRITE
+// ASYNCHRONOUS ENGINE
 ////////////////////////////////////////////////
-// Function to write data to the link layer.
-// Returns the number of bytes written or -1 on error.
-int llwrite(const unsigned char *buf, int bufSize) {
+// llwrite and llread are blocking wrappers around a non-blocking engine.
+// Operations are submitted with llwriteAsync / llreadAsync and driven by
+// llprocess, which the host loop calls whenever llgetfd() becomes readable
+// or llnextDeadline() milliseconds have elapsed.
 
-    // Calculate frame size and allocate memory for the frame
-    int frameSize = 6 + bufSize;
-    unsigned char *frame = (unsigned char *) malloc(frameSize);
-    
-    // Construct the frame
-    frame[0] = FLAG;
-    frame[1] = A_TX;
-    frame[2] = C_N(tramaTx);
-    frame[3] = (frame[1] ^ frame[2]);
+// Pending write (a single outstanding I-frame, stop-and-wait)
+int txActive = FALSE;                  // Flag to indicate if a write is pending
+unsigned char *txFrame = NULL;         // Stuffed frame being transmitted
+int txFrameSize = 0;                   // Size of the stuffed frame
+int txAttempts = 0;                    // Number of retransmissions of the pending frame
+struct timespec txDeadline;            // Instant at which the pending frame times out
+int txWaiting = FALSE;                 // Flag to indicate the pending frame waits for pacing credit
+int peerBusy = FALSE;                  // Flag to indicate the peer answered RNR
+volatile sig_atomic_t rnrSent = FALSE; // Flag to indicate RNR was sent and no read was posted since
+llCallback txCallback = NULL;          // Completion callback of the pending write
+void *txContext = NULL;                // User context of the pending write
+
+// Pending read
+int rxActive = FALSE;                  // Flag to indicate if a read is posted
+struct iovec rxIov[MAX_IOV];           // Segments of the posted read
+int rxIovCount = 0;                    // Number of segments of the posted read
+llCallback rxCallback = NULL;          // Completion callback of the posted read
+void *rxContext = NULL;                // User context of the posted read
 
-    memcpy(frame + 4, buf, bufSize);
+// Input read from the serial port but not parsed yet
+unsigned char inBuffer[BUF_SIZE];      // Bytes read from the serial port
+int inPosition = 0;                    // Next byte of inBuffer to parse
+int inLength = 0;                      // Number of valid bytes in inBuffer
+int completions = 0;                   // Number of completions since llopen
 
-    // Calculate and append BCC2
-    unsigned char BCC2 = buf[0];
-    for (unsigned int i = 1; i < bufSize; i++) {
-        BCC2 ^= buf[i];
+// Receive parser, fed one byte at a time by llprocess
+llState rxState = START;               // Current state of the frame parser
+unsigned char rxAddress = 0;           // Address field of the frame being parsed
+unsigned char rxCtrlField = 0;         // Control field of the frame being parsed
+int rxDiscard = FALSE;                 // Flag to drop the I-frame being parsed (no read posted)
+int rxSegment = 0;                     // Segment of the posted read being filled
+size_t rxOffset = 0;                   // Offset inside the segment being filled
+int rxLength = 0;                      // Number of payload bytes stored so far
+int rxOverflow = FALSE;                // Flag to indicate the payload did not fit the posted read
+unsigned char rxPending = 0;           // Last destuffed byte, held back as it may be BCC2
+int rxHasPending = FALSE;              // Flag to indicate rxPending holds a byte
+unsigned char rxBcc2 = 0;              // Running BCC2 of the stored payload bytes
+CobsDecoder rxCobs;                    // Decoder of the I-frame being parsed (COBS framing)
+
+// Soft combining: corrupted copies of the expected I-frame (payload followed by BCC2)
+unsigned char rxCopies[SOFT_COMBINE_COPIES][MAX_PACKET_SIZE + 1]; // Retained copies
+int rxCopyLength[SOFT_COMBINE_COPIES]; // Length of each retained copy
+int rxCopyCount = 0;                   // Number of retained copies
+int rxCopyNext = 0;                    // Slot the next copy is retained in
+unsigned char rxCombined[MAX_PACKET_SIZE + 1]; // Copy being parsed, then the combined frame
+
+// Function to set a deadline "milliseconds" from now.
+void llsetDeadlineMs(struct timespec *deadline, int milliseconds) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += milliseconds / 1000;
+    deadline->tv_nsec += (milliseconds % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
     }
+}
 
-    // Byte stuffing
-    int j = 4;
-    for (unsigned int i = 0; i < bufSize; i++) {
-        if (buf[i] == FLAG || buf[i] == ESC) {
-            frame = realloc(frame, ++frameSize);
-            frame[j++] = ESC;
+// Function to compute the milliseconds left until a deadline (0 if already expired).
+int llremaining(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return (ms > 0) ? (int) ms : 0;
+}
+
+// Function to add the line time elapsed since the last refill to the pacing credit.
+// The credit never exceeds the line time of one frame, so bursts stay short.
+void llpaceRefill() {
+    if (paceRate == 0) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long maximum = (long) MAX_FRAME_SIZE * 1000000 / paceRate;
+    paceCredit += (now.tv_sec - paceStamp.tv_sec) * 1000000 + (now.tv_nsec - paceStamp.tv_nsec) / 1000;
+    if (paceCredit > maximum) paceCredit = maximum;
+    paceStamp = now;
+}
+
+// Function to compute the milliseconds until "bytes" can be written (0 if they can right away).
+int llpaceDelay(int bytes) {
+    if (paceRate == 0) return 0;
+    llpaceRefill();
+    long missing = (long) bytes * 1000000 / paceRate - paceCredit;
+    return (missing > 0) ? (int) ((missing + 999) / 1000) : 0;
+}
+
+// Function to write "bytes" to the serial port, charging their line time to the pacing credit.
+// Supervision frames are never held back, the credit may go negative to cover them.
+// Returns the result of write.
+int llwriteLine(const unsigned char *buf, int bytes) {
+    if (paceRate > 0) {
+        llpaceRefill();
+        paceCredit -= (long) bytes * 1000000 / paceRate;
+    }
+
+    // An RNR sent by alarmHandler must not land in the middle of this frame
+    sigset_t alarmSet, previous;
+    int blocked = ackHeld;
+    if (blocked) {
+        sigemptyset(&alarmSet);
+        sigaddset(&alarmSet, SIGALRM);
+        sigprocmask(SIG_BLOCK, &alarmSet, &previous);
+    }
+    int result = transportWrite(&transport, buf, bytes);
+    if (blocked) sigprocmask(SIG_SETMASK, &previous, NULL);
+    return result;
+}
+
+// Function to hold the acknowledgment of a frame delivered while no read is posted. Posting
+// the next read sends it as RR; after ACK_GRACE_PERIOD alarmHandler answers RNR instead.
+void llholdAck() {
+    struct itimerval grace = {{0, 0}, {ACK_GRACE_PERIOD / 1000, (ACK_GRACE_PERIOD % 1000) * 1000}};
+    ackHeld = TRUE;
+    setitimer(ITIMER_REAL, &grace, NULL);
+}
+
+// Function to cancel the grace timer of a held acknowledgment.
+// The timer is stopped first, so alarmHandler never sees it cleared mid-way.
+void llreleaseAck() {
+    struct itimerval off = {{0, 0}, {0, 0}};
+    if (!ackHeld) return;
+    setitimer(ITIMER_REAL, &off, NULL);
+    ackHeld = FALSE;
+}
+
+// Function to answer RNR once the grace period of a held acknowledgment runs out.
+// Runs in alarmHandler, while the owner is busy outside the engine.
+void llholdPeer() {
+    unsigned char frame[5] = {FLAG, ownAddress, C_RNR(tramaRx), ownAddress ^ C_RNR(tramaRx), FLAG};
+    ackHeld = FALSE;
+    rnrSent = TRUE;
+    transportWrite(&transport, frame, 5);
+}
+
+// Function to send a supervision frame.
+// Returns 1 on success or -1 on error.
+int llsendSupervision(unsigned char address, unsigned char ctrlField) {
+    unsigned char frame[5] = {FLAG, address, ctrlField, address ^ ctrlField, FLAG};
+    if (llwriteLine(frame, 5) < 0) {
+        printf("Send Frame Error\n");
+        return -1;
+    }
+    return 1;
+}
+
+// Function to finish the pending write and notify its owner.
+void llcompleteWrite(int result) {
+    llCallback callback = txCallback;
+    void *context = txContext;
+
+    poolPut(&framePool, txFrame);
+    txFrame = NULL;
+    txActive = FALSE;
+    completions++;
+    if (callback != NULL) callback(result, context);
+}
+
+// Function to finish the posted read and notify its owner.
+void llcompleteRead(int result) {
+    llCallback callback = rxCallback;
+    void *context = rxContext;
+
+    rxActive = FALSE;
+    rxIovCount = 0;
+    completions++;
+    if (callback != NULL) callback(result, context);
+}
+
+// Function to put the pending frame on the line, with a fresh piggybacked Nr.
+// A busy peer is only polled after a timeout, and pacing may hold the frame back (txWaiting).
+void llresend() {
+    txWaiting = FALSE;
+    if (peerBusy) {
+        llsetDeadline(&txDeadline, timeout);
+        return;
+    }
+    if (llpaceDelay(txFrameSize) > 0) {
+        txWaiting = TRUE;
+        return;
+    }
+
+    // Control fields never need stuffing
+    txFrame[2] = C_I(tramaTx, tramaRx);
+    txFrame[3] = txFrame[1] ^ txFrame[2];
+    ackPending = FALSE;
+    llreleaseAck();
+
+    if (llwriteLine(txFrame, txFrameSize) < 0) {
+        llcompleteWrite(-1);
+        return;
+    }
+    llsetDeadline(&txDeadline, timeout);
+}
+
+// Function to handle a sign that the peer takes I-frames again (RR, REJ or an I-frame).
+// The pending frame was dropped or held back while the peer was busy: send it now.
+void llpeerReady() {
+    if (!peerBusy) return;
+    peerBusy = FALSE;
+    if (txActive && !txWaiting) llresend();
+}
+
+// Function to start re-establishing a link that stopped answering.
+// The transmitter sends SET with backoff, the receiver waits to hear from it.
+void llstartReconnect() {
+    if (reconnecting) return;
+    printf("Link down, reconnecting\n");
+    reconnecting = TRUE;
+    reconnectDelay = 1;
+    llsetDeadline(&reconnectDeadline, 0);
+    llsetDeadline(&reconnectGiveUp, RECONNECT_TIMEOUT);
+}
+
+// Function to handle any frame from the peer: the link is alive.
+// A link being re-established is up again, and the pending frame is sent again from the same Ns.
+void llpeerHeard() {
+    probesUnanswered = 0;
+    llsetDeadline(&keepaliveDeadline, KEEPALIVE_INTERVAL);
+
+    if (!reconnecting) return;
+    reconnecting = FALSE;
+    statistics.reconnections++;
+    printf("Link re-established\n");
+    if (txActive) {
+        txAttempts = 0;
+        llresend();
+    }
+}
+
+// Function to retransmit the pending frame after a rejection or a timeout.
+void llretransmit() {
+    txAttempts++;
+
+    // Once the maximum number of retransmissions is reached the link is considered down
+    if (txAttempts >= retransmissions) {
+        llstartReconnect();
+        return;
+    }
+    llresend();
+}
+
+// Function to handle an acknowledgment of every frame before "nr".
+void llacknowledge(unsigned char nr) {
+
+    // The peer still expects the pending frame: nothing to acknowledge
+    if (!txActive || nr == tramaTx) return;
+
+    tramaTx = (tramaTx + 1) % 2;  // Ns module-2 counter (enables to distinguish frame 0 and frame 1)
+    statistics.framesAcked++;
+    llcompleteWrite(txFrameSize);
+}
+
+// Function to handle a complete supervision (or unnumbered) frame from the peer.
+void llhandleSupervision(unsigned char ctrlField) {
+
+    // The transmitter re-establishes the link: confirm it, keeping the sequence numbers and framing
+    if (role == receiver && (ctrlField == C_SET || ctrlField == C_SET_COBS)) {
+        llsendSupervision(ownAddress, (framing == FRAMING_COBS) ? C_UA_COBS : C_UA);
+        return;
+    }
+
+    // Keepalive probe: answered with RR at the end of llprocess
+    if (role == receiver && ctrlField == C_KEEPALIVE) {
+        ackPending = TRUE;
+        return;
+    }
+
+    // Disconnection requested by the transmitter: answer it and end the read
+    if (role == receiver && ctrlField == C_DISC) {
+        if (llsendSupervision(ownAddress, C_DISC) < 0) {
+            if (rxActive) llcompleteRead(-1);
+            return;
         }
-        frame[j++] = buf[i];
+        if (rxActive) llcompleteRead(0);
+        return;
     }
-    frame[j++] = BCC2;
-    frame[j++] = FLAG;
 
-    int currentTransmission = 0;
+    // Frame accepted by the peer, which is ready for the next one
+    if (ctrlField == C_RR(0) || ctrlField == C_RR(1)) {
+        llacknowledge(ctrlField >> 7);
+        llpeerReady();
+    }
+    // Frames before Nr accepted, but the peer cannot take another one yet
+    else if (ctrlField == C_RNR(0) || ctrlField == C_RNR(1)) {
+        peerBusy = TRUE;
+        llacknowledge(ctrlField >> 7);
+        if (txActive && !txWaiting) llsetDeadline(&txDeadline, timeout);
+    }
+    // Frame rejected by the peer, unless it already expects the next one
+    else if (ctrlField == C_REJ(0) || ctrlField == C_REJ(1)) {
+        peerBusy = FALSE;
+        if (txActive && (ctrlField >> 7) == tramaTx) {
+            statistics.rejections++;
+            llretransmit();
+        }
+        else llacknowledge(ctrlField >> 7);
+    }
+}
 
-    // Loop until successful transmission or maximum retransmissions reached
-    while (currentTransmission < retransmissions) {
-        alarmEnabled = FALSE;
-        alarm(timeout);
+// Function to copy "length" payload bytes between the segments of the posted read and "buffer".
+void llcopyRead(unsigned char *buffer, int length, int toSegments) {
+    for (int k = 0; k < rxIovCount && length > 0; k++) {
+        int n = (rxIov[k].iov_len < (size_t) length) ? rxIov[k].iov_len : length;
+        if (toSegments) memcpy(rxIov[k].iov_base, buffer, n);
+        else memcpy(buffer, rxIov[k].iov_base, n);
+        buffer += n;
+        length -= n;
+    }
+}
 
-        // Inner loop for waiting acknowledgment frames
-        while (alarmEnabled == FALSE) {
-            int bytes = write(fd, frame, j);
-            if (bytes < 0) return -1;
+// Function to check a frame (payload followed by BCC2): the XOR of every byte is 0 if BCC2 holds.
+int llchecksOut(const unsigned char *frame, int length) {
+    unsigned char parity = 0;
+    for (int i = 0; i < length; i++)
+        parity ^= frame[i];
+    return parity == 0;
+}
 
-            // Read supervision frame and check control field
-            unsigned char byte, ctrlField = 0;
-            llState state = START;
+// Function to mix two copies that differ in a few bytes, taking each byte from either copy.
+// The mix is only trusted if exactly one of them satisfies BCC2.
+// Returns TRUE if "current" was turned into that mix.
+int llcombinePair(unsigned char *current, const unsigned char *copy, int length) {
+    int differences[SOFT_COMBINE_MAX_DIFFERENCES];
+    int count = 0;
+    unsigned char parity = 0;
 
-            // Loop until the end of frame is received or an alarm is triggered
-            while (state != STOP_RECEIVED && alarmEnabled == FALSE) {
-                if (read(fd, &byte, 1) > 0 || 1) {
-                    switch (state) {
-                        case START:
-                            if (byte == FLAG) state = FLAG_RECEIVED;
-                            break;
-                        case FLAG_RECEIVED:
-                            if (byte == A_RX) state = A_RECEIVED;
-                            else if (byte != FLAG) state = START;
-                            break;
-                        case A_RECEIVED:
-                            if (byte == C_RR(0) || byte == C_RR(1) || byte == C_REJ(0) || byte == C_REJ(1) || byte == C_DISC) {
-                                state = C_RECEIVED;
-                                ctrlField = byte;
-                            } else if (byte == FLAG) state = FLAG_RECEIVED;
-                            else state = START;
-                            break;
-                        case C_RECEIVED:
-                            if (byte == (A_RX ^ ctrlField)) state = BCC_CHECK;
-                            else if (byte == FLAG) state = FLAG_RECEIVED;
-                            else state = START;
-                            break;
-                        case BCC_CHECK:
-                            if (byte == FLAG) state = STOP_RECEIVED;
-                            else state = START;
-                            break;
-                        default:
-                            break;
-                    }
+    for (int i = 0; i < length; i++) {
+        parity ^= current[i];
+        if (current[i] != copy[i]) {
+            if (count == SOFT_COMBINE_MAX_DIFFERENCES) return FALSE;
+            differences[count++] = i;
+        }
+    }
+    if (count == 0) return FALSE;
+
+    // Taking byte i from the copy changes the parity by current[i] ^ copy[i]
+    int match = -1;
+    for (int mask = 1; mask < (1 << count); mask++) {
+        unsigned char mixed = parity;
+        for (int d = 0; d < count; d++)
+            if (mask & (1 << d)) mixed ^= current[differences[d]] ^ copy[differences[d]];
+        if (mixed != 0) continue;
+        if (match >= 0) return FALSE;
+        match = mask;
+    }
+    if (match < 0) return FALSE;
+
+    for (int d = 0; d < count; d++)
+        if (match & (1 << d)) current[differences[d]] = copy[differences[d]];
+    return TRUE;
+}
+
+// Function to rebuild the expected I-frame from the corrupted copy just parsed and the copies
+// retained before it: a per-byte majority vote across three copies, or a BCC2-guided mix of two.
+// The copy is retained if nothing checks out.
+// Returns TRUE if the rebuilt payload was stored in the posted read.
+int llsoftCombine() {
+    int length = rxLength + 1;
+    llcopyRead(rxCombined, rxLength, FALSE);
+    rxCombined[rxLength] = rxPending;
+
+    // Only copies of the same length can be lined up byte by byte
+    int same[SOFT_COMBINE_COPIES];
+    int n = 0;
+    for (int c = 0; c < rxCopyCount; c++)
+        if (rxCopyLength[c] == length) same[n++] = c;
+
+    int recovered = FALSE;
+    if (n >= 2) {
+        unsigned char voted[MAX_PACKET_SIZE + 1];
+        const unsigned char *a = rxCopies[same[0]];
+        const unsigned char *b = rxCopies[same[1]];
+        for (int i = 0; i < length; i++)
+            voted[i] = (a[i] == b[i]) ? a[i] : rxCombined[i];
+        if (llchecksOut(voted, length)) {
+            memcpy(rxCombined, voted, length);
+            recovered = TRUE;
+        }
+    }
+    for (int c = 0; c < n && !recovered; c++) {
+        unsigned char mixed[MAX_PACKET_SIZE + 1];
+        memcpy(mixed, rxCombined, length);
+        if (llcombinePair(mixed, rxCopies[same[c]], length)) {
+            memcpy(rxCombined, mixed, length);
+            recovered = TRUE;
+        }
+    }
+
+    if (recovered) {
+        printf("Frame recovered from %d corrupted copies\n", n + 1);
+        statistics.framesRecovered++;
+        llcopyRead(rxCombined, rxLength, TRUE);
+        return TRUE;
+    }
+
+    // Keep this copy for the next retransmission, replacing the oldest one
+    memcpy(rxCopies[rxCopyNext], rxCombined, length);
+    rxCopyLength[rxCopyNext] = length;
+    rxCopyNext = (rxCopyNext + 1) % SOFT_COMBINE_COPIES;
+    if (rxCopyCount < SOFT_COMBINE_COPIES) rxCopyCount++;
+    return FALSE;
+}
+
+// Function to handle a complete I-frame, whose payload was already destuffed into the posted read.
+void llhandleInformation() {
+    unsigned char ns = (rxCtrlField >> 6) & 1;
+    unsigned char nr = rxCtrlField >> 7;
+
+    // Nothing was posted to receive the frame: a new one is held by the peer until a read is
+    // posted, a duplicate is acknowledged again. The header is protected by BCC1, so Nr holds.
+    if (rxDiscard) {
+        if (ns == tramaRx) {
+            llsendSupervision(ownAddress, C_RNR(tramaRx));
+            rnrSent = TRUE;
+        }
+        else ackPending = TRUE;
+        llacknowledge(nr);
+        llpeerReady();
+        return;
+    }
+
+    // An empty frame can only be the product of noise
+    if (!rxHasPending) return;
+
+    // The byte held back is BCC2, compare it with the running BCC2 of the payload
+    int valid = !rxOverflow && rxPending == rxBcc2 &&
+                (framing != FRAMING_COBS || cobsDecoderComplete(&rxCobs));
+    int deliver = FALSE;
+
+    // A corrupted copy of the expected frame may be rebuilt from the copies received before it
+    if (!valid && !rxOverflow && ns == tramaRx) valid = llsoftCombine();
+
+    if (!valid) {
+        // If BCC2 is incorrect, request retransmission and keep the read posted
+        printf("Retransmission Error\n");
+        llsendSupervision(ownAddress, C_REJ(tramaRx));
+    }
+    else if (ns != tramaRx) {
+        // Duplicate of a frame already delivered (its acknowledgment was lost): acknowledge it again
+        ackPending = TRUE;
+    }
+    else {
+        // New frame: acknowledged by the next outgoing I-frame, or by RR at the end of llprocess
+        tramaRx = (tramaRx + 1) % 2; // Nr module-2 counter (enables to distinguish frame 0 and frame 1)
+        ackPending = TRUE;
+        rxCopyCount = 0;
+        rxCopyNext = 0;
+        deliver = TRUE;
+    }
+
+    // The header is protected by BCC1, so the piggybacked Nr holds even if the payload is corrupted
+    llacknowledge(nr);
+    llpeerReady();
+
+    if (deliver) {
+        printf("-----------------------\n");
+        printf("Received %d bytes\n", rxLength);
+        llcompleteRead(rxLength);
+    }
+}
+
+// Function to store a payload byte in the segments of the posted read.
+void llcommitByte(unsigned char byte) {
+    while (rxSegment < rxIovCount && rxOffset == rxIov[rxSegment].iov_len) {
+        rxSegment++;
+        rxOffset = 0;
+    }
+    if (rxSegment == rxIovCount) {
+        rxOverflow = TRUE;
+        return;
+    }
+    ((unsigned char *) rxIov[rxSegment].iov_base)[rxOffset++] = byte;
+    rxBcc2 ^= byte;
+    rxLength++;
+}
+
+// Function to append a destuffed byte to the I-frame being parsed.
+// Each byte is held back by one position so BCC2 never reaches the destination.
+void llstoreByte(unsigned char byte) {
+    if (rxDiscard) return;
+    if (rxHasPending) llcommitByte(rxPending);
+    rxPending = byte;
+    rxHasPending = TRUE;
+}
+
+// Function to advance the receive parser by one byte.
+void llparseByte(unsigned char byte) {
+    switch (rxState) {
+        case START:
+            if (byte == FLAG) rxState = FLAG_RECEIVED;
+            break;
+        case FLAG_RECEIVED:
+            if (byte == peerAddress) {
+                rxAddress = byte;
+                rxState = A_RECEIVED;
+            }
+            else if (byte != FLAG) rxState = START;
+            break;
+        case A_RECEIVED:
+            if (byte == FLAG) rxState = FLAG_RECEIVED;
+            else {
+                rxCtrlField = byte;
+                rxState = C_RECEIVED;
+            }
+            break;
+        case C_RECEIVED:
+            if (byte == (rxAddress ^ rxCtrlField)) {
+                // A header protected by BCC1 is proof enough that the peer is there
+                llpeerHeard();
+
+                // I-frames carry data, every other frame ends right after BCC1
+                if (IS_C_I(rxCtrlField)) {
+                    rxDiscard = !rxActive;
+                    rxSegment = 0;
+                    rxOffset = 0;
+                    rxLength = 0;
+                    rxOverflow = FALSE;
+                    rxHasPending = FALSE;
+                    rxBcc2 = 0;
+                    cobsDecoderInit(&rxCobs, FLAG);
+                    rxState = (framing == FRAMING_COBS) ? COBS_DECODING : BYTE_DESTUFFING;
                 }
+                else rxState = BCC_CHECK;
+            }
+            else if (byte == FLAG) rxState = FLAG_RECEIVED;
+            else rxState = START;
+            break;
+        case BCC_CHECK:
+            if (byte == FLAG) {
+                rxState = FLAG_RECEIVED;
+                llhandleSupervision(rxCtrlField);
+            }
+            else rxState = START;
+            break;
+        case BYTE_DESTUFFING:
+            if (byte == ESC) rxState = DATA_FOUND;
+            else if (byte == FLAG) {
+                rxState = FLAG_RECEIVED;
+                llhandleInformation();
             }
+            else llstoreByte(byte);
+            break;
+        case DATA_FOUND:
+            rxState = BYTE_DESTUFFING;
+            if (byte == ESC || byte == FLAG) llstoreByte(byte);
+            else {
+                llstoreByte(ESC);
+                llstoreByte(byte);
+            }
+            break;
+        case COBS_DECODING:
+            if (byte == FLAG) {
+                rxState = FLAG_RECEIVED;
+                llhandleInformation();
+            }
+            else {
+                int decoded = cobsDecode(&rxCobs, byte);
+                if (decoded >= 0) llstoreByte(decoded);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-            // Break the loop if the frame is accepted
-            if (ctrlField == C_RR(0) || ctrlField == C_RR(1)) {
-                tramaTx = (tramaTx + 1) % 2;  // Nr module-2 counter (enables to distinguish frame 0 and frame 1)
-                free(frame);
-                return frameSize;
+// Function to submit a write, gathered from "iovcnt" segments, without waiting for its acknowledgment.
+// Returns 1 if the write was submitted or -1 on error.
+int llwritevAsync(const struct iovec *iov, int iovcnt, llCallback callback, void *context) {
+
+    size_t bufSize = 0;
+    for (int k = 0; k < iovcnt; k++)
+        bufSize += iov[k].iov_len;
+
+    if (txActive || linkFailed || bufSize == 0 || bufSize > MAX_PACKET_SIZE) return -1;
+
+    // Frame buffers fit the worst case, where every byte is stuffed
+    unsigned char *frame = poolGet(&framePool);
+    if (frame == NULL) return -1;
+
+    // Construct the frame header
+    frame[0] = FLAG;
+    frame[1] = ownAddress;
+    frame[2] = C_I(tramaTx, tramaRx);
+    frame[3] = (frame[1] ^ frame[2]);
+
+    unsigned char BCC2 = 0;
+    int j = 4;
+
+    if (framing == FRAMING_COBS) {
+        // COBS encoding straight from each segment, followed by BCC2
+        CobsEncoder encoder;
+        cobsEncoderInit(&encoder, frame + 4, FLAG);
+        for (int k = 0; k < iovcnt; k++) {
+            const unsigned char *buf = (const unsigned char *) iov[k].iov_base;
+            for (size_t i = 0; i < iov[k].iov_len; i++)
+                BCC2 ^= buf[i];
+            cobsEncode(&encoder, buf, iov[k].iov_len);
+        }
+        cobsEncode(&encoder, &BCC2, 1);
+        j = cobsEncoderFinish(&encoder) - frame;
+    }
+    else {
+        // Byte stuffing straight from each segment, calculating BCC2 on the way
+        for (int k = 0; k < iovcnt; k++) {
+            const unsigned char *buf = (const unsigned char *) iov[k].iov_base;
+            for (size_t i = 0; i < iov[k].iov_len; i++) {
+                BCC2 ^= buf[i];
+                if (buf[i] == FLAG || buf[i] == ESC) frame[j++] = ESC;
+                frame[j++] = buf[i];
             }
+        }
+
+        // BCC2 is stuffed too, as it may collide with FLAG or ESC
+        if (BCC2 == FLAG || BCC2 == ESC) frame[j++] = ESC;
+        frame[j++] = BCC2;
+    }
+    frame[j++] = FLAG;
+
+    txFrame = frame;
+    txFrameSize = j;
+    txAttempts = 0;
+    txCallback = callback;
+    txContext = context;
+    txActive = TRUE;
+    statistics.framesSent++;
+
+    // The frame carries the acknowledgment as Nr, a write error completes it with -1
+    llresend();
+    return 1;
+}
+
+// Function to submit a write without waiting for its acknowledgment.
+// Returns 1 if the write was submitted or -1 on error.
+int llwriteAsync(const unsigned char *buf, int bufSize, llCallback callback, void *context) {
+    if (bufSize <= 0) return -1;
+    struct iovec iov = {(void *) buf, bufSize};
+    return llwritevAsync(&iov, 1, callback, context);
+}
+
+// Function to post "iovcnt" segments to be filled, in order, by the next I-frame.
+// Returns 1 if the read was posted or -1 on error.
+int llreadvAsync(const struct iovec *iov, int iovcnt, llCallback callback, void *context) {
+
+    if (rxActive || iovcnt <= 0 || iovcnt > MAX_IOV) return -1;
+
+    memcpy(rxIov, iov, iovcnt * sizeof(struct iovec));
+    rxIovCount = iovcnt;
+    rxCallback = callback;
+    rxContext = context;
+    rxActive = TRUE;
+
+    // The held acknowledgment, or the RR that lets a held peer resume, goes out right away
+    if (ackHeld || rnrSent) {
+        llreleaseAck();
+        rnrSent = FALSE;
+        ackPending = TRUE;
+    }
+    return 1;
+}
+
+// Function to post a buffer of at least MAX_PACKET_SIZE bytes for the next I-frame.
+// Returns 1 if the read was posted or -1 on error.
+int llreadAsync(unsigned char *packet, llCallback callback, void *context) {
+    if (packet == NULL) return -1;
+    struct iovec iov = {packet, MAX_PACKET_SIZE};
+    return llreadvAsync(&iov, 1, callback, context);
+}
+
+// Function to take a packet buffer from the pool.
+// Returns the buffer or NULL if every buffer is in use.
+unsigned char *llgetPacket() {
+    return poolGet(&packetPool);
+}
+
+// Function to give a packet buffer back to the pool.
+void llputPacket(unsigned char *packet) {
+    poolPut(&packetPool, packet);
+}
+
+// Function to get the transfer statistics of the current connection.
+void llgetStatistics(LinkStatistics *stats) {
+    *stats = statistics;
+}
+
+// Function to get the file descriptor the host loop should poll for input.
+int llgetfd() {
+    return transport.fd;
+}
+
+// Batching: llsend packs messages, each prefixed by its 2-byte length, into the batch being
+// filled while the previous batch is in flight; llrecv splits them back out
+int batchDelay = BATCH_DEFAULT_DELAY;  // Milliseconds a batch may wait for more messages
+int batchLimit = MAX_PACKET_SIZE;      // Maximum size of a batch
+unsigned char batchBuffers[2][MAX_PACKET_SIZE]; // Batch in flight and batch being filled
+int batchLength[2] = {0, 0};           // Bytes used in each batch buffer
+int batchFilling = 0;                  // Buffer of the batch being filled
+struct timespec batchDeadline;         // Instant at which the batch being filled is due
+int batchFailed = FALSE;               // Flag to indicate a batch could not be delivered
+unsigned char rxBatch[MAX_PACKET_SIZE]; // Batch being split by llrecv
+int rxBatchLength = 0;                 // Size of the batch being split
+int rxBatchPosition = 0;               // Next message of the batch being split
+
+int llsubmitBatch();
 
-            // If the frame is rejected, increment transmission counter
-            currentTransmission++;
+// Completion callback of a batch: the next one goes at once if its delay already expired.
+void llbatchSent(int result, void *context) {
+    if (result < 0) batchFailed = TRUE;
+    else if (batchLength[batchFilling] > 0 && llremaining(&batchDeadline) == 0) llsubmitBatch();
+}
+
+// Function to submit the batch being filled and start filling the other buffer.
+// Returns 1 on success or -1 on error.
+int llsubmitBatch() {
+    if (llwriteAsync(batchBuffers[batchFilling], batchLength[batchFilling], llbatchSent, NULL) < 0) return -1;
+    batchFilling ^= 1;
+    batchLength[batchFilling] = 0;
+    return 1;
+}
+
+// Function to wait up to "timeout" milliseconds (-1 forever) for input.
+// Returns 1 if input is available, 0 on timeout or -1 on error.
+int llpoll(int timeout) {
+    return transportWait(&transport, timeout);
+}
 
-            // Break the loop if maximum retransmissions are reached
-            if (currentTransmission >= retransmissions) {
-                free(frame);
-                llclose(1);
+// Function to get the milliseconds until the engine needs to run again.
+// Returns -1 when there is no pending deadline.
+int llnextDeadline() {
+    // Input left over from a previous call must be parsed right away, and RR sent at once
+    if (inPosition < inLength || ackPending) return 0;
+    if (txActive && txWaiting) return llpaceDelay(txFrameSize);
+    if (reconnecting) {
+        int giveUp = llremaining(&reconnectGiveUp);
+        int next = llremaining(&reconnectDeadline);
+        return (role == transmitter && next < giveUp) ? next : giveUp;
+    }
+    if (txActive) return llremaining(&txDeadline);
+
+    int deadline = (role == transmitter && !linkFailed) ? llremaining(&keepaliveDeadline) : -1;
+    if (batchLength[batchFilling] > 0 && (deadline < 0 || llremaining(&batchDeadline) < deadline))
+        deadline = llremaining(&batchDeadline);
+    return deadline;
+}
+
+// Function to drive the engine: consume the available input and handle expired deadlines.
+// Parsing stops after an operation completes, so the owner can post the next read before
+// the frames that follow are parsed (they would be discarded otherwise).
+// Returns 1 on success or -1 on error.
+int llprocess() {
+    int start = completions;
+
+    while (completions == start) {
+        if (inPosition == inLength) {
+            int bytes = transportRead(&transport, inBuffer, BUF_SIZE);
+
+            // The transport failed or the peer hung up: fail the pending operations
+            if (bytes < 0) {
+                linkFailed = TRUE;
+                if (txActive) llcompleteWrite(-1);
+                if (rxActive) llcompleteRead(-1);
                 return -1;
             }
+            if (bytes == 0) break;
+            inPosition = 0;
+            inLength = bytes;
+        }
+        while (inPosition < inLength && completions == start)
+            llparseByte(inBuffer[inPosition++]);
+    }
+
+    if (reconnecting) {
+        // Give up on a link that stayed down, failing the pending write
+        if (llremaining(&reconnectGiveUp) == 0) {
+            printf("Link could not be re-established\n");
+            reconnecting = FALSE;
+            linkFailed = TRUE;
+            if (txActive) llcompleteWrite(-1);
         }
+        // Send SET again, doubling the delay up to RECONNECT_MAX_DELAY
+        else if (role == transmitter && llremaining(&reconnectDeadline) == 0) {
+            if (llsendSupervision(ownAddress, (framing == FRAMING_COBS) ? C_SET_COBS : C_SET) < 0) return -1;
+            llsetDeadline(&reconnectDeadline, reconnectDelay);
+            reconnectDelay = (reconnectDelay * 2 > RECONNECT_MAX_DELAY) ? RECONNECT_MAX_DELAY : reconnectDelay * 2;
+        }
+    }
+    // Send the pending frame once pacing allows it
+    else if (txActive && txWaiting) {
+        if (llpaceDelay(txFrameSize) == 0) llresend();
+    }
+    // Poll a busy peer with the pending frame, which does not count as a retransmission
+    else if (txActive && peerBusy && llremaining(&txDeadline) == 0) {
+        statistics.busy++;
+        peerBusy = FALSE;
+        llresend();
+    }
+    // Retransmit the pending frame once its timeout expires
+    else if (txActive && llremaining(&txDeadline) == 0) {
+        alarmCount++;
+        statistics.timeouts++;
+        printf("Alarm #%d\n", alarmCount);
+        llretransmit();
+    }
+    // Probe an idle link, which is considered down once enough probes go unanswered
+    else if (!txActive && role == transmitter && !linkFailed && llremaining(&keepaliveDeadline) == 0) {
+        if (probesUnanswered >= KEEPALIVE_PROBES) llstartReconnect();
+        else {
+            if (llsendSupervision(ownAddress, C_KEEPALIVE) < 0) return -1;
+            probesUnanswered++;
+            llsetDeadline(&keepaliveDeadline, KEEPALIVE_INTERVAL);
+        }
+    }
+
+    // Submit the batch being filled once the link is free and its delay has expired
+    if (!txActive && !reconnecting && batchLength[batchFilling] > 0 && llremaining(&batchDeadline) == 0) {
+        if (llsubmitBatch() < 0) return -1;
     }
 
-    // This part should not be reached, but added for completeness
-    free(frame);
-    return -1;
+    // No outgoing I-frame picked up the acknowledgment: send it on its own. Without a read
+    // posted it is held for the next one, unless the peer is already held by RNR
+    if (ackPending) {
+        ackPending = FALSE;
+        if (rxActive || rnrSent) {
+            if (llsendSupervision(ownAddress, rxActive ? C_RR(tramaRx) : C_RNR(tramaRx)) < 0) return -1;
+        }
+        else if (!ackHeld) llholdAck();
+    }
+    return 1;
+}
+
+// Completion callback used by the blocking wrappers to store the result.
+void llstoreResult(int result, void *context) {
+    *(int *) context = result;
+}
+
+// Function to drive the engine until "*pending" is cleared.
+// Returns 1 on success or -1 on error.
+int llwait(const int *pending) {
+    while (*pending) {
+        if (llpoll(llnextDeadline()) < 0) return -1;
+        if (llprocess() < 0) return -1;
+    }
+    return 1;
+}
+
+////////////////////////////////////////////////
+// LLWRITE
+////////////////////////////////////////////////
+// Function to write data to the link layer.
+// Returns the number of bytes written or -1 on error.
+int llwrite(const unsigned char *buf, int bufSize) {
+    if (bufSize <= 0) return -1;
+    struct iovec iov = {(void *) buf, bufSize};
+    return llwritev(&iov, 1);
+}
+
+////////////////////////////////////////////////
+// LLWRITEV
+////////////////////////////////////////////////
+// Function to write data gathered from "iovcnt" segments as a single frame.
+// Returns the number of bytes written or -1 on error.
+int llwritev(const struct iovec *iov, int iovcnt) {
+    int result = -1;
+
+    if (llwritevAsync(iov, iovcnt, llstoreResult, &result) < 0) return -1;
+    if (llwait(&txActive) < 0) return -1;
+
+    // Close the link once the maximum number of retransmissions is reached
+    if (result < 0) llclose(1);
+    return result;
 }
 
 ////////////////////////////////////////////////
@@ -304,99 +1111,93 @@ int llwrite(const unsigned char *buf, int bufSize) {
 // Function to read data from the link layer.
 // Returns the number of bytes read or -1 on error.
 int llread(unsigned char *packet) {
+    int result = -1;
 
-    unsigned char byte;
-    unsigned char ctrlField;
-    int i = 0;
-    llState state = START;
-    // Loop until the end of frame is received
-    while (state != STOP_RECEIVED) {  
-        int bytes = read(fd, &byte, 1);
-        if (bytes > 0) {
-            switch (state) {
-                case START:
-                    if (byte == FLAG) state = FLAG_RECEIVED;
-                    break;
-                case FLAG_RECEIVED:
-                    if (byte == A_TX) state = A_RECEIVED;
-                    else if (byte != FLAG) state = START;
-                    break;
-                case A_RECEIVED:
-                    if (byte == C_N(0) || byte == C_N(1)){
-                        state = C_RECEIVED;
-                        ctrlField = byte;   
-                    }
-                    else if (byte == FLAG) state = FLAG_RECEIVED;
-                    else if (byte == C_DISC) {
-                        unsigned char discFrame[5] = {FLAG, A_RX, C_DISC, A_RX ^ C_DISC, FLAG};
-                        if (write(fd, discFrame, 5) < 0) {
-                            printf("Send Frame Error\n");
-                            return -1;
-                        }
-                        return 0;
-                    }
-                    else state = START;
-                    break;
-                case C_RECEIVED:
-                    if (byte == (A_TX ^ ctrlField)) state = BYTE_DESTUFFING;
-                    else if (byte == FLAG) state = FLAG_RECEIVED;
-                    else state = START;
-                    break;
-                case BYTE_DESTUFFING:
-                    if (byte == ESC) state = DATA_FOUND;
-                    else if (byte == FLAG){
-                        unsigned char bcc2 = packet[i-1];
-                        i--;
-                        packet[i] = '\0'; 
-                        unsigned char bcc2Check = packet[0];
-
-                        // Check BCC2 for error detection
-                        for (unsigned int j = 1; j < i; j++)
-                            bcc2Check ^= packet[j];
-
-                        // If BCC2 is correct, stop receiving and send acknowledgment
-                        if (bcc2 == bcc2Check){
-                            state = STOP_RECEIVED;
-                            unsigned char rrFrame[5] = {FLAG, A_RX, C_RR(tramaRx), A_RX ^ C_RR(tramaRx), FLAG};
-                            if (write(fd, rrFrame, 5) < 0) {
-                                printf("Send Frame Error\n");
-                            }
-                            tramaRx = (tramaRx + 1) % 2; // Ns module-2 counter (enables to distinguish frame 0 and frame 1)
-                            printf("-----------------------\n");
-                            printf("Received %d bytes\n", i);
-                            return i; 
-                        }
-                        // If BCC2 is incorrect, request retransmission
-                        else{
-                            printf("Retransmission Error\n");
-                            unsigned char rejFrame[5] = {FLAG, A_RX, C_REJ(tramaRx), A_RX ^ C_REJ(tramaRx), FLAG};
-                            if (write(fd, rejFrame, 5) < 0) {
-                                printf("Send Frame Error\n");
-                            }
-                            return -1;
-                        };
+    if (llreadAsync(packet, llstoreResult, &result) < 0) return -1;
+    if (llwait(&rxActive) < 0) return -1;
+    return result;
+}
 
-                    }
-                    else{
-                        packet[i++] = byte;
-                    }
-                    break;
-                case DATA_FOUND:
-                    state = BYTE_DESTUFFING;
-                    if (byte == ESC || byte == FLAG) packet[i++] = byte;
-                    else{
-                        packet[i++] = ESC;
-                        packet[i++] = byte;
-                    }
-                    break;
-                default: 
-                    break;
-            }
-        }
+////////////////////////////////////////////////
+// LLREADV
+////////////////////////////////////////////////
+// Function to read an I-frame, scattering its payload over "iovcnt" segments.
+// Returns the number of bytes read or -1 on error.
+int llreadv(const struct iovec *iov, int iovcnt) {
+    int result = -1;
+
+    if (llreadvAsync(iov, iovcnt, llstoreResult, &result) < 0) return -1;
+    if (llwait(&rxActive) < 0) return -1;
+    return result;
+}
+
+////////////////////////////////////////////////
+// LLSEND
+////////////////////////////////////////////////
+// Function to choose the maximum delay and size of a batch.
+void llsetBatching(int maxDelay, int maxSize) {
+    batchDelay = (maxDelay < 0) ? 0 : maxDelay;
+    batchLimit = (maxSize <= 2 || maxSize > MAX_PACKET_SIZE) ? MAX_PACKET_SIZE : maxSize;
+}
+
+// Function to queue a message in the batch being filled.
+// Blocks only when the batch is full and the previous one is still in flight.
+// Returns the length of the message or -1 on error.
+int llsend(const unsigned char *message, int length) {
+    if (length <= 0 || length + 2 > batchLimit || batchFailed) return -1;
+
+    // Take the acknowledgments received so far, which may free the link for a batch
+    if (llprocess() < 0) return -1;
+
+    // No room left: submit the batch as soon as the link is free (unless llbatchSent already did)
+    while (batchLength[batchFilling] + 2 + length > batchLimit) {
+        if (txActive ? llwait(&txActive) < 0 : llsubmitBatch() < 0) return -1;
+        if (batchFailed) return -1;
+    }
+
+    unsigned char *batch = batchBuffers[batchFilling];
+    int position = batchLength[batchFilling];
+    if (position == 0) llsetDeadlineMs(&batchDeadline, batchDelay);
+    batch[position] = length >> 8 & 0xFF;
+    batch[position + 1] = length & 0xFF;
+    memcpy(batch + position + 2, message, length);
+    batchLength[batchFilling] = position + 2 + length;
+    return length;
+}
+
+// Function to submit the messages still queued and wait until every batch is acknowledged.
+// Returns 1 on success or -1 on error.
+int llflush() {
+    while (txActive || batchLength[batchFilling] > 0) {
+        if (txActive ? llwait(&txActive) < 0 : llsubmitBatch() < 0) return -1;
+        if (batchFailed) return -1;
+    }
+    return 1;
+}
+
+////////////////////////////////////////////////
+// LLRECV
+////////////////////////////////////////////////
+// Function to receive the next message sent with llsend.
+// Returns the length of the message, 0 once the peer disconnects or -1 on error.
+int llrecv(unsigned char *message) {
+
+    // Read the next batch once this one is split
+    while (rxBatchPosition + 2 > rxBatchLength) {
+        int size = llread(rxBatch);
+        if (size <= 0) return size;
+        rxBatchLength = size;
+        rxBatchPosition = 0;
     }
 
-    // Return -1 if an error occurs
-    return -1;
+    int length = rxBatch[rxBatchPosition] << 8 | rxBatch[rxBatchPosition + 1];
+    if (rxBatchPosition + 2 + length > rxBatchLength) {
+        rxBatchPosition = rxBatchLength;
+        return -1;
+    }
+    memcpy(message, rxBatch + rxBatchPosition + 2, length);
+    rxBatchPosition += 2 + length;
+    return length;
 }
 
 
@@ -410,6 +1211,17 @@ int llclose(int showStatistics) {
 
     llState state = START;
     unsigned char byte;
+    int result = 1;
+
+    // The alarm times the DISC retransmissions from here on
+    llreleaseAck();
+
+    // Deliver the messages still batched and wait for the frame in flight, so DISC never
+    // overtakes data that may still need a retransmission
+    if ((txActive || batchLength[batchFilling] > 0) && llflush() < 0) {
+        printf("Batched messages lost\n");
+        result = -1;
+    }
     (void) signal(SIGALRM, alarmHandler);
     
     // Loop until the maximum number of retransmissions is reached or the connection is closed
@@ -417,9 +1229,10 @@ int llclose(int showStatistics) {
                 
         // Construct and send DISC frame
         unsigned char discFrame[5] = {FLAG, A_TX, C_DISC, A_TX ^ C_DISC, FLAG};
-        if (write(fd, discFrame, 5) < 0) {
+        if (transportWrite(&transport, discFrame, 5) < 0) {
             printf("Send Frame Error\n");
-            return -1;
+            result = -1;
+            break;
         }
 
         alarm(timeout);
@@ -428,7 +1241,7 @@ int llclose(int showStatistics) {
         // Wait for response
         while (alarmEnabled == FALSE && state != STOP_RECEIVED) {
 
-            if (read(fd, &byte, 1) > 0) {
+            if (transportRead(&transport, &byte, 1) > 0) {
                 switch (state) {
                     case START:
                         if (byte == FLAG) state = FLAG_RECEIVED;
@@ -460,21 +1273,29 @@ int llclose(int showStatistics) {
     }
 
     // Check if the connection is closed
-    if (state != STOP_RECEIVED) return -1;
-
-    // Construct and send UA frame to acknowledge the DISC frame
-    unsigned char uaFrame[5] = {FLAG, A_TX, C_UA, A_TX ^ C_UA, FLAG};
-    if (write(fd, uaFrame, 5) < 0) {
-        printf("Send Frame Error\n");
-        return -1;
+    if (state != STOP_RECEIVED) result = -1;
+    else {
+        // Construct and send UA frame to acknowledge the DISC frame. The peer may hang up as
+        // soon as it has answered DISC, which still closes the link cleanly
+        unsigned char uaFrame[5] = {FLAG, A_TX, C_UA, A_TX ^ C_UA, FLAG};
+        if (transportWrite(&transport, uaFrame, 5) < 0 && errno != EPIPE && errno != ECONNRESET) {
+            printf("Send Frame Error\n");
+            result = -1;
+        }
     }
 
     // Print statistics if required
     if (showStatistics == 1) {
         clock_t end_time = clock();
         printf("Elapsed time: %f seconds\n", (double)(end_time - start_time) / CLOCKS_PER_SEC);
+        printf("Frames sent: %d, acknowledged: %d, rejected: %d, timed out: %d, recovered: %d, reconnections: %d, busy: %d\n",
+               statistics.framesSent, statistics.framesAcked, statistics.rejections, statistics.timeouts,
+               statistics.framesRecovered, statistics.reconnections, statistics.busy);
     }
     
-    // Close the file descriptor
-    return close(fd);
+    // Release the buffer pools and close the transport, whether or not the close succeeded
+    poolDestroy(&framePool);
+    poolDestroy(&packetPool);
+    if (transportClose(&transport) < 0) result = -1;
+    return result;
 }
\ No newline at end of file
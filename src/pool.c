@@ -0,0 +1,56 @@
+// Fixed-size buffer pool implementation
+
+#include "pool.h"
+#include <stdlib.h>
+
+// Function to create a pool of "capacity" buffers of at least "bufferSize" bytes.
+// Returns 1 on success or -1 on error.
+int poolInit(Pool *pool, size_t bufferSize, int capacity) {
+
+    // Every buffer must hold the free list link and stay pointer aligned
+    if (bufferSize < sizeof(void *)) bufferSize = sizeof(void *);
+    bufferSize = (bufferSize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    pool->arena = (unsigned char *) malloc(bufferSize * capacity);
+    if (pool->arena == NULL) return -1;
+
+    pool->bufferSize = bufferSize;
+    pool->capacity = capacity;
+    pool->available = 0;
+    pool->freeList = NULL;
+
+    // Chain every buffer into the free list
+    for (int i = capacity - 1; i >= 0; i--)
+        poolPut(pool, pool->arena + i * bufferSize);
+
+    return 1;
+}
+
+// Function to take a buffer from the pool.
+// Returns the buffer or NULL if the pool is exhausted.
+unsigned char *poolGet(Pool *pool) {
+    if (pool->freeList == NULL) return NULL;
+
+    unsigned char *buffer = (unsigned char *) pool->freeList;
+    pool->freeList = *(void **) buffer;
+    pool->available--;
+    return buffer;
+}
+
+// Function to give a buffer back to the pool it was taken from.
+void poolPut(Pool *pool, unsigned char *buffer) {
+    if (buffer == NULL) return;
+
+    *(void **) buffer = pool->freeList;
+    pool->freeList = buffer;
+    pool->available++;
+}
+
+// Function to release the arena of the pool.
+void poolDestroy(Pool *pool) {
+    free(pool->arena);
+    pool->arena = NULL;
+    pool->freeList = NULL;
+    pool->capacity = 0;
+    pool->available = 0;
+}
@@ -0,0 +1,380 @@
+// Transport backend implementation
+
+#include "transport.h"
+#include "link_layer.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+////////////////////////////////////////////////
+// SERIAL PORT
+////////////////////////////////////////////////
+
+// Function to convert a baud rate into its termios speed.
+// Returns the speed, or B0 if the baud rate is not supported.
+speed_t baudRateSpeed(int baudRate) {
+    switch (baudRate) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B0;
+    }
+}
+
+// Function to open and configure a serial port.
+// The port always runs at BAUDRATE, which "baudRate" is set to.
+// Returns 1 on success or -1 on error.
+int serialOpen(Transport *transport, const char *serialPort, int *baudRate, int server) {
+
+    // Open the serial port
+    int fd = open(serialPort, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(serialPort);
+        return -1; 
+    }
+
+    // Configure the serial port settings
+    struct termios oldtio;
+    struct termios newtio;
+
+    if (tcgetattr(fd, &oldtio) == -1) {
+        perror("tcgetattr");
+        exit(-1);
+    }
+
+    memset(&newtio, 0, sizeof(newtio));
+
+    *baudRate = BAUDRATE;
+    newtio.c_cflag = baudRateSpeed(BAUDRATE) | CS8 | CLOCAL | CREAD;
+    newtio.c_iflag = IGNPAR;
+    newtio.c_oflag = 0;
+    newtio.c_lflag = 0;
+    newtio.c_cc[VTIME] = 0;
+    newtio.c_cc[VMIN] = 0;
+
+    tcflush(fd, TCIOFLUSH);
+
+    if (tcsetattr(fd, TCSANOW, &newtio) == -1) {
+        perror("tcsetattr");
+        close(fd);
+        return -1;
+    }
+
+    transport->fd = fd;
+    return 1;
+}
+
+// Function to read the available bytes of a serial port or socket.
+// Returns the number of bytes read (0 if none) or -1 on error.
+int fdRead(Transport *transport, unsigned char *buf, int size) {
+    int bytes = read(transport->fd, buf, size);
+    if (bytes < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    return bytes;
+}
+
+// Function to write every byte to a serial port or socket, waiting while its buffer is full.
+// Sockets are written with MSG_NOSIGNAL, so a peer that went away is an error and not SIGPIPE.
+// Returns size or -1 on error.
+int fdWriteAll(int fd, const unsigned char *buf, int size, int socket) {
+    int written = 0;
+    while (written < size) {
+        int bytes = socket ? send(fd, buf + written, size - written, MSG_NOSIGNAL)
+                           : write(fd, buf + written, size - written);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) return -1;
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        written += bytes;
+    }
+    return size;
+}
+
+// Function to write every byte to a serial port.
+// Returns size or -1 on error.
+int serialWrite(Transport *transport, const unsigned char *buf, int size) {
+    return fdWriteAll(transport->fd, buf, size, FALSE);
+}
+
+// Function to wait for input on a serial port or socket.
+// Returns 1 if input is available, 0 on timeout or -1 on error.
+int fdWait(Transport *transport, int timeout) {
+    struct pollfd pfd = {transport->fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0) return (errno == EINTR) ? 0 : -1;
+    return ready;
+}
+
+// Function to close a serial port or socket.
+int fdClose(Transport *transport) {
+    return close(transport->fd);
+}
+
+const TransportOps serialOps = {serialOpen, fdRead, serialWrite, fdWait, fdClose, TRUE};
+
+////////////////////////////////////////////////
+// UNIX-DOMAIN SOCKET
+////////////////////////////////////////////////
+
+// Function to open a UNIX-domain socket: the server listens on "path" and accepts one peer,
+// the client connects to it, waiting up to TRANSPORT_CONNECT_TIMEOUT seconds for it to appear.
+// Returns 1 on success or -1 on error.
+int unixOpen(Transport *transport, const char *path, int *baudRate, int server) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    if (server) {
+        unlink(path);
+        if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, 1) < 0) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        // Once the peer is connected the path is no longer needed
+        int peer = accept(fd, NULL, NULL);
+        close(fd);
+        unlink(path);
+        if (peer < 0) {
+            perror("accept");
+            return -1;
+        }
+        fd = peer;
+    }
+    else {
+        int attempts = TRANSPORT_CONNECT_TIMEOUT * 10;
+        while (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+            if ((errno != ENOENT && errno != ECONNREFUSED) || --attempts == 0) {
+                perror(path);
+                close(fd);
+                return -1;
+            }
+            usleep(100000);
+        }
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    transport->fd = fd;
+    return 1;
+}
+
+// Function to read the available bytes of a socket, failing once the peer has closed it.
+// Returns the number of bytes read (0 if none) or -1 on error (ECONNRESET once closed).
+int unixRead(Transport *transport, unsigned char *buf, int size) {
+    int bytes = read(transport->fd, buf, size);
+    if (bytes == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if (bytes < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    return bytes;
+}
+
+// Function to write every byte to a socket.
+// Returns size or -1 on error.
+int unixWrite(Transport *transport, const unsigned char *buf, int size) {
+    return fdWriteAll(transport->fd, buf, size, TRUE);
+}
+
+const TransportOps unixOps = {unixOpen, unixRead, unixWrite, fdWait, fdClose, FALSE};
+
+////////////////////////////////////////////////
+// SHARED-MEMORY RING
+////////////////////////////////////////////////
+
+// Function to sleep until the futex word at "address" changes from "value" or "timeout"
+// milliseconds pass (-1 forever). The word is shared, so the wait works across processes.
+void futexWait(_Atomic unsigned int *address, unsigned int value, int timeout) {
+    struct timespec ts = {timeout / 1000, (timeout % 1000) * 1000000L};
+    syscall(SYS_futex, (unsigned int *) address, FUTEX_WAIT, value, (timeout < 0) ? NULL : &ts, NULL, 0);
+}
+
+// Function to wake the processes sleeping on the futex word at "address".
+void futexWake(_Atomic unsigned int *address) {
+    syscall(SYS_futex, (unsigned int *) address, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Function to map the shared memory "name": the server creates it afresh, the client waits
+// up to TRANSPORT_CONNECT_TIMEOUT seconds for the server to create it.
+// Returns 1 on success or -1 on error.
+int shmOpen(Transport *transport, const char *name, int *baudRate, int server) {
+    int fd;
+
+    if (server) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0 && ftruncate(fd, sizeof(ShmSegment)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else {
+        // The segment is only usable once the server has given it its size
+        struct stat st;
+        for (int attempts = TRANSPORT_CONNECT_TIMEOUT * 10; attempts > 0; attempts--) {
+            fd = shm_open(name, O_RDWR, 0600);
+            if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size == sizeof(ShmSegment)) break;
+            if (fd >= 0) close(fd);
+            fd = -1;
+            usleep(100000);
+        }
+    }
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+
+    transport->segment = (ShmSegment *) mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    // Once both ends have it mapped the name is no longer needed
+    if (transport->segment == MAP_FAILED || !server) shm_unlink(name);
+    if (transport->segment == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    // The receiver (server) reads what the transmitter writes on the first ring
+    transport->in = &transport->segment->rings[server ? 0 : 1];
+    transport->out = &transport->segment->rings[server ? 1 : 0];
+    transport->fd = -1;
+    return 1;
+}
+
+// Function to read the available bytes of the incoming ring.
+// Returns the number of bytes read (0 if none).
+int shmRead(Transport *transport, unsigned char *buf, int size) {
+    ShmRing *ring = transport->in;
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned int count = head - tail;
+    if (count > (unsigned int) size) count = size;
+    if (count == 0) return 0;
+
+    // Copy in at most two pieces, as the data may wrap around the end of the ring
+    unsigned int offset = tail & (SHM_RING_SIZE - 1);
+    unsigned int first = (count < SHM_RING_SIZE - offset) ? count : SHM_RING_SIZE - offset;
+    memcpy(buf, ring->data + offset, first);
+    memcpy(buf + first, ring->data, count - first);
+
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    futexWake(&ring->tail);
+    return count;
+}
+
+// Function to write every byte to the outgoing ring, sleeping while it is full.
+// Returns size.
+int shmWrite(Transport *transport, const unsigned char *buf, int size) {
+    ShmRing *ring = transport->out;
+    int written = 0;
+
+    while (written < size) {
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        unsigned int space = SHM_RING_SIZE - (head - tail);
+        if (space == 0) {
+            futexWait(&ring->tail, tail, -1);
+            continue;
+        }
+        if (space > (unsigned int) (size - written)) space = size - written;
+
+        unsigned int offset = head & (SHM_RING_SIZE - 1);
+        unsigned int first = (space < SHM_RING_SIZE - offset) ? space : SHM_RING_SIZE - offset;
+        memcpy(ring->data + offset, buf + written, first);
+        memcpy(ring->data, buf + written + first, space - first);
+
+        atomic_store_explicit(&ring->head, head + space, memory_order_release);
+        futexWake(&ring->head);
+        written += space;
+    }
+    return size;
+}
+
+// Function to wait for data on the incoming ring.
+// Returns 1 if input is available or 0 on timeout.
+int shmWait(Transport *transport, int timeout) {
+    ShmRing *ring = transport->in;
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head != tail) return 1;
+
+    // The kernel only sleeps if head still equals the value read, so no wake-up is lost
+    futexWait(&ring->head, head, timeout);
+    return atomic_load_explicit(&ring->head, memory_order_acquire) != tail;
+}
+
+// Function to unmap the shared memory.
+int shmClose(Transport *transport) {
+    return munmap(transport->segment, sizeof(ShmSegment));
+}
+
+const TransportOps shmOps = {shmOpen, shmRead, shmWrite, shmWait, shmClose, FALSE};
+
+////////////////////////////////////////////////
+// DISPATCH
+////////////////////////////////////////////////
+
+// Function to open the backend selected by the prefix of "address".
+// Returns 1 on success or -1 on error.
+int transportOpen(Transport *transport, const char *address, int *baudRate, int server) {
+    memset(transport, 0, sizeof(Transport));
+    transport->ops = &serialOps;
+
+    if (strncmp(address, TRANSPORT_UNIX_PREFIX, strlen(TRANSPORT_UNIX_PREFIX)) == 0) {
+        transport->ops = &unixOps;
+        address += strlen(TRANSPORT_UNIX_PREFIX);
+        snprintf(transport->name, sizeof(transport->name), "%s", address);
+    }
+    else if (strncmp(address, TRANSPORT_SHM_PREFIX, strlen(TRANSPORT_SHM_PREFIX)) == 0) {
+        transport->ops = &shmOps;
+        address += strlen(TRANSPORT_SHM_PREFIX);
+
+        // Shared memory names start with a single slash
+        snprintf(transport->name, sizeof(transport->name), "%s%s", (address[0] == '/') ? "" : "/", address);
+        address = transport->name;
+    }
+    return transport->ops->open(transport, address, baudRate, server);
+}
+
+// Function to read up to "size" available bytes.
+int transportRead(Transport *transport, unsigned char *buf, int size) {
+    return transport->ops->read(transport, buf, size);
+}
+
+// Function to write all "size" bytes.
+int transportWrite(Transport *transport, const unsigned char *buf, int size) {
+    return transport->ops->write(transport, buf, size);
+}
+
+// Function to wait up to "timeout" milliseconds for input.
+int transportWait(Transport *transport, int timeout) {
+    return transport->ops->wait(transport, timeout);
+}
+
+// Function to release the transport.
+int transportClose(Transport *transport) {
+    return transport->ops->close(transport);
+}